@@ -0,0 +1,157 @@
+// Beam search decoding.
+// Every step scores all live beams with one predict_batch call (one GEMM
+// per layer), masks the tokens the repetition rules forbid, and keeps the
+// width best extensions by total log-probability in a min-heap. Beams
+// record only their last token and a parent index per step, so common
+// prefixes are stored once and the winner is recovered by backtracking.
+#include "brook.h"
+
+int beam_width = 1;              // "beam B"; 1 generates by sampling
+
+// One live hypothesis: the sliding context it predicts from
+typedef struct {
+    text_generator gen;          // context and repetition state (no text)
+    float score;                 // sum of log p of the generated tokens
+} beam_state;
+
+typedef struct {
+    float score;
+    int beam;
+    int token;
+} beam_candidate;
+
+// Min-heap of the width best candidates
+static void candidate_push(beam_candidate* heap, int* count, int width, beam_candidate c) {
+    int i;
+    if (*count < width) {
+        i = (*count)++;
+        while (i > 0 && heap[(i - 1) / 2].score > c.score) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else {
+        if (c.score <= heap[0].score) return;
+        i = 0;
+        for (;;) {
+            int child = 2 * i + 1;
+            if (child >= *count) break;
+            if (child + 1 < *count && heap[child + 1].score < heap[child].score) child++;
+            if (heap[child].score >= c.score) break;
+            heap[i] = heap[child];
+            i = child;
+        }
+    }
+    heap[i] = c;
+}
+
+// Indices of the width largest logits of a row, into top[]; returns the count
+static int row_top(const float* row, int width, int* top) {
+    int n = 0;
+    for (int j = 0; j < vocab_size; j++) {
+        if (row[j] <= MASKED_LOGIT) continue;
+        if (n == width && row[j] <= row[top[n - 1]]) continue;
+        int pos = (n < width) ? n++ : n - 1;
+        while (pos > 0 && row[top[pos - 1]] < row[j]) {
+            top[pos] = top[pos - 1];
+            pos--;
+        }
+        top[pos] = j;
+    }
+    return n;
+}
+
+/**
+ * Beam search for steps words continuing seed_string, with width beams
+ * (1..MAX_BEAM_WIDTH). Deterministic: the session's sampling settings and
+ * PRNG are not used. Writes the best beam's text to out (truncated to
+ * out_size) and returns its length.
+ */
+size_t generate_beam(brook_session* session, const char* seed_string, int steps, int width,
+                     char* out, size_t out_size) {
+    if (out_size == 0) return 0;
+    if (width < 1) width = 1;
+    if (width > MAX_BEAM_WIDTH) width = MAX_BEAM_WIDTH;
+
+    beam_state beams[MAX_BEAM_WIDTH], next_beams[MAX_BEAM_WIDTH];
+    beam_candidate heap[MAX_BEAM_WIDTH];
+    const int* ctx[MAX_BEAM_WIDTH];
+    int lens[MAX_BEAM_WIDTH], top[MAX_BEAM_WIDTH];
+    char scratch[1];
+    float* logits = malloc((size_t)width * vocab_size * sizeof(float));
+    int* hist_token = malloc((size_t)(steps > 0 ? steps : 1) * width * sizeof(int));
+    int* hist_parent = malloc((size_t)(steps > 0 ? steps : 1) * width * sizeof(int));
+    if (!logits || !hist_token || !hist_parent) {
+        printf("Error: Could not allocate beam search buffers\n");
+        exit(1);
+    }
+
+    // The seed's generator formats the final text; beams only track state
+    text_generator result;
+    generator_begin(&result, seed_string, out, out_size);
+    beams[0].gen = result;
+    beams[0].gen.out = scratch;
+    beams[0].gen.out_size = sizeof(scratch);
+    beams[0].score = 0.0f;
+    int n_beams = 1;
+    int length = 0;              // steps completed
+
+    for (int step = 0; step < steps; step++) {
+        for (int b = 0; b < n_beams; b++) {
+            ctx[b] = beams[b].gen.context;
+            lens[b] = beams[b].gen.context_len;
+        }
+        predict_batch(session, ctx, lens, n_beams, NULL, NULL, NULL, logits);
+
+        int count = 0;
+        for (int b = 0; b < n_beams; b++) {
+            float* row = &logits[(size_t)b * vocab_size];
+            int masked[GENERATOR_MASKED];
+            int n_masked = generator_masked(&beams[b].gen, masked);
+            for (int m = 0; m < n_masked; m++) row[masked[m]] = MASKED_LOGIT;
+            int n_top = row_top(row, width, top);
+            float max_logit = simd->max(row, vocab_size);
+            float top_logit[MAX_BEAM_WIDTH];
+            for (int t = 0; t < n_top; t++) top_logit[t] = row[top[t]];
+            float log_sum = max_logit + logf(simd->exp_sum(row, vocab_size, max_logit));
+            for (int t = 0; t < n_top; t++) {
+                beam_candidate c = { beams[b].score + top_logit[t] - log_sum, b, top[t] };
+                candidate_push(heap, &count, width, c);
+            }
+        }
+        if (count == 0) break;
+
+        // Best first, so beam 0 is always the leader
+        for (int i = 1; i < count; i++) {
+            beam_candidate c = heap[i];
+            int j = i;
+            while (j > 0 && heap[j - 1].score < c.score) {
+                heap[j] = heap[j - 1];
+                j--;
+            }
+            heap[j] = c;
+        }
+        for (int i = 0; i < count; i++) {
+            next_beams[i] = beams[heap[i].beam];
+            next_beams[i].score = heap[i].score;
+            generator_push(&next_beams[i].gen, heap[i].token);
+            hist_token[(size_t)step * width + i] = heap[i].token;
+            hist_parent[(size_t)step * width + i] = heap[i].beam;
+        }
+        memcpy(beams, next_beams, count * sizeof(beam_state));
+        n_beams = count;
+        length = step + 1;
+    }
+
+    // Backtrack the leader and format it like sampled text
+    int* path = malloc((size_t)(length > 0 ? length : 1) * sizeof(int));
+    for (int step = length - 1, b = 0; step >= 0; step--) {
+        path[step] = hist_token[(size_t)step * width + b];
+        b = hist_parent[(size_t)step * width + b];
+    }
+    for (int step = 0; step < length; step++) generator_push(&result, path[step]);
+    free(path);
+    free(logits);
+    free(hist_token);
+    free(hist_parent);
+    return generator_finish(&result);
+}
@@ -0,0 +1,618 @@
+// BROOK microbenchmarks
+// Usage: ./brook_bench [--json FILE] [--label LABEL] [corpus...]
+// Corpora default to data/story.txt; the first one is also the training
+// data for the training step and inference benchmarks. Every number
+// printed is also recorded under a stable name and, with --json, written
+// as one JSON object (host, SIMD set, seed, label, results) so runs can be
+// diffed across commits and hosts. rand(), training and sessions use BENCH_SEED.
+#include "brook.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+typedef struct {
+    char name[64];
+    const char* unit;
+    double value;
+} bench_result;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+
+// Records value under the printf-formatted name
+static void record(const char* unit, double value, const char* fmt, ...) {
+    if (result_count >= BENCH_MAX_RESULTS) return;
+    bench_result* r = &results[result_count++];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(r->name, sizeof(r->name), fmt, args);
+    va_end(args);
+    r->unit = unit;
+    r->value = value;
+}
+
+static void json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int write_json(const char* path, const char* label) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        printf("Error: Could not write %s\n", path);
+        return 0;
+    }
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(f, "{\n  \"label\": ");
+    json_string(f, label);
+    fprintf(f, ",\n  \"time\": \"%s\",\n  \"host\": ", stamp);
+    json_string(f, host);
+    fprintf(f, ",\n  \"cpus\": %ld,\n  \"simd\": \"%s\",\n  \"compiler\": ", sysconf(_SC_NPROCESSORS_ONLN), simd->name);
+    json_string(f, __VERSION__);
+    fprintf(f, ",\n  \"seed\": %d,\n  \"results\": {\n", BENCH_SEED);
+    for (int i = 0; i < result_count; i++) {
+        fprintf(f, "    ");
+        json_string(f, results[i].name);
+        fprintf(f, ": { \"value\": %.6g, \"unit\": \"%s\" }%s\n", results[i].value, results[i].unit,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+    fclose(f);
+    printf("Wrote %d results to %s\n", result_count, path);
+    return 1;
+}
+
+// Corpus file name without directory or extension, for result names
+static void corpus_name(const char* path, char* out, size_t size) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(out, size, "%s", base);
+    char* dot = strrchr(out, '.');
+    if (dot && dot != out) *dot = '\0';
+}
+
+static char* read_file(const char* filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        printf("Error: Could not open %s\n", filename);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = (char*)malloc(file_size + 1);
+    if (!text) {
+        fclose(f);
+        return NULL;
+    }
+    size_t bytes_read = fread(text, 1, file_size, f);
+    text[bytes_read] = '\0';
+    fclose(f);
+    return text;
+}
+
+// Reference lookup: the original linear strcmp scan over vocab[]
+static int linear_lookup(const char* word) {
+    for (int i = 0; i < vocab_size; i++)
+        if (strcmp(vocab[i], word) == 0) return i;
+    return -1;
+}
+
+// Tokenizes text repeatedly with the given lookup and returns tokens/sec
+static double bench_tokenize(const char* text, int* out, int max_tokens,
+                             token_lookup_fn lookup, int* out_count) {
+    int count = 0, reps = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        tokenize_generic(text, out, &count, max_tokens, lookup);
+        reps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < 0.5);
+    *out_count = count;
+    return (double)count * reps / elapsed;
+}
+
+static void bench_tokenizer(const char* filename) {
+    char* text = read_file(filename);
+    if (!text) return;
+    size_t len = strlen(text);
+    int max_tokens = (int)len + 1;  // at most one token per char
+    int* out = malloc(max_tokens * sizeof(int));
+
+    // Build the vocabulary once, as load_training_data would
+    init_vocab();
+    double start = now_seconds();
+    int count = 0;
+    tokenize_generic(text, out, &count, max_tokens, token_lookup_add);
+    double build = now_seconds() - start;
+    printf("tokenizer: %s, %zu chars, %d tokens, %d unique words\n",
+           filename, len, count, vocab_size);
+    printf("  vocab build (hash):   %.3fs, %.0f tokens/sec\n", build, count / build);
+
+    int linear_count, hash_count;
+    double linear = bench_tokenize(text, out, max_tokens, linear_lookup, &linear_count);
+    double hashed = bench_tokenize(text, out, max_tokens, token_lookup_existing, &hash_count);
+    printf("  lookup (linear scan): %.0f tokens/sec\n", linear);
+    printf("  lookup (hash index):  %.0f tokens/sec\n", hashed);
+    printf("  speedup: %.1fx\n", hashed / linear);
+    char name[48];
+    corpus_name(filename, name, sizeof(name));
+    record("tokens/s", count / build, "tokenizer.%s.build", name);
+    record("tokens/s", linear, "tokenizer.%s.linear", name);
+    record("tokens/s", hashed, "tokenizer.%s.hash", name);
+    if (linear_count != hash_count)
+        printf("  Warning: token counts differ (%d vs %d)\n", linear_count, hash_count);
+
+    free(out);
+    free(text);
+}
+
+// fast_matmul throughput for the default layer shapes, per kernel set
+static void bench_kernels() {
+    const int shapes[][2] = { {512, MAX_EMBED}, {256, 512}, {128, 256}, {4270, 128} };
+    const char* kernel_sets[] = { "scalar", "avx2", "avx512" };
+    const simd_kernels* saved = simd;
+
+    printf("fast_matmul (rows x cols): GFLOP/s\n");
+    for (int s = 0; s < 4; s++) {
+        int rows = shapes[s][0], cols = shapes[s][1];
+        float* Wm = malloc((size_t)rows * cols * sizeof(float));
+        float* x = malloc(cols * sizeof(float));
+        float* out = malloc(rows * sizeof(float));
+        for (int i = 0; i < rows * cols; i++) Wm[i] = (float)rand() / RAND_MAX - 0.5f;
+        for (int i = 0; i < cols; i++) x[i] = (float)rand() / RAND_MAX - 0.5f;
+
+        printf("  %4d x %-4d", rows, cols);
+        for (int k = 0; k < 3; k++) {
+            if (!simd_select(kernel_sets[k])) continue;
+            long reps = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                fast_matmul(Wm, x, out, rows, cols);
+                reps++;
+                elapsed = now_seconds() - start;
+            } while (elapsed < 0.2);
+            double gflops = 2.0 * rows * cols * reps / elapsed * 1e-9;
+            printf("  %s %.2f", kernel_sets[k], gflops);
+            record("GFLOP/s", gflops, "matmul.%dx%d.%s", rows, cols, kernel_sets[k]);
+        }
+
+        // Same product with bf16 weights (mixed precision training)
+        simd = saved;
+        bf16* Wb = malloc((size_t)rows * cols * sizeof(bf16));
+        for (int i = 0; i < rows * cols; i++) Wb[i] = float_to_bf16(Wm[i]);
+        long reps = 0;
+        double start = now_seconds(), elapsed;
+        do {
+            fast_matmul_bf16(Wb, x, out, rows, cols);
+            reps++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < 0.2);
+        double gflops = 2.0 * rows * cols * reps / elapsed * 1e-9;
+        printf("  %s-bf16 %.2f\n", simd->name, gflops);
+        record("GFLOP/s", gflops, "matmul.%dx%d.bf16", rows, cols);
+        free(Wb);
+        free(Wm);
+        free(x);
+        free(out);
+    }
+    simd = saved;
+}
+
+// The pre-kernel backward delta loop: column walk with stride in_size
+static void column_walk_t(const float* Wm, const float* x, float* out, int out_size, int in_size) {
+    for (int j = 0; j < in_size; j++) {
+        float sum = 0.0f;
+        for (int k = 0; k < out_size; k++) sum += Wm[k * in_size + j] * x[k];
+        out[j] = sum;
+    }
+}
+
+// W^T * delta for each backward step of the default 512/256/128 layout,
+// old column walk vs row-streaming fast_matmul_t
+static void bench_backward_deltas() {
+    const int shapes[][2] = { {4270, 128}, {128, 256}, {256, 512} };
+
+    printf("W^T * delta (rows x cols): column walk vs row streaming, GFLOP/s\n");
+    for (int s = 0; s < 3; s++) {
+        int rows = shapes[s][0], cols = shapes[s][1];
+        float* Wm = malloc((size_t)rows * cols * sizeof(float));
+        float* delta = malloc(rows * sizeof(float));
+        float* out = malloc(cols * sizeof(float));
+        float* ref = malloc(cols * sizeof(float));
+        for (int i = 0; i < rows * cols; i++) Wm[i] = (float)rand() / RAND_MAX - 0.5f;
+        for (int i = 0; i < rows; i++) delta[i] = (float)rand() / RAND_MAX - 0.5f;
+
+        double rate[2];
+        for (int k = 0; k < 2; k++) {
+            long reps = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                if (k == 0) column_walk_t(Wm, delta, ref, rows, cols);
+                else fast_matmul_t(Wm, delta, out, rows, cols);
+                reps++;
+                elapsed = now_seconds() - start;
+            } while (elapsed < 0.2);
+            rate[k] = 2.0 * rows * cols * reps / elapsed * 1e-9;
+        }
+        float max_err = 0.0f;
+        for (int j = 0; j < cols; j++) {
+            float err = fabsf(out[j] - ref[j]);
+            if (err > max_err) max_err = err;
+        }
+        printf("  %4d x %-4d  column %.2f  rows %.2f  (%.1fx, max diff %.1e)\n",
+               rows, cols, rate[0], rate[1], rate[1] / rate[0], max_err);
+        record("GFLOP/s", rate[0], "matmul_t.%dx%d.column", rows, cols);
+        record("GFLOP/s", rate[1], "matmul_t.%dx%d.rows", rows, cols);
+        free(Wm);
+        free(delta);
+        free(out);
+        free(ref);
+    }
+}
+
+// The pre-fusion output step: materialize every logit, then a max pass and
+// a top-k insertion pass that rescans the k array on each replacement
+static void materialized_top_k(const float* h, float* logits, int k, int* idx, float* val) {
+    int cols = hidden_sizes[num_hidden_layers - 1];
+    fast_matmul(W_output, h, logits, vocab_size, cols);
+    volatile float max_logit = simd->max(logits, vocab_size);
+    (void)max_logit;
+    int filled = 0, min_pos = 0;
+    for (int i = 0; i < vocab_size; i++) {
+        if (filled < k) {
+            idx[filled] = i;
+            val[filled++] = logits[i];
+        } else if (logits[i] > val[min_pos]) {
+            idx[min_pos] = i;
+            val[min_pos] = logits[i];
+        } else {
+            continue;
+        }
+        min_pos = 0;
+        for (int j = 1; j < filled; j++) if (val[j] < val[min_pos]) min_pos = j;
+    }
+}
+
+// Output projection + top-k: materialized logits vs the fused streaming kernel
+static void bench_output_top_k() {
+    const int ks[] = { 5, 40 };
+    int cols = hidden_sizes[num_hidden_layers - 1];
+    float* h = malloc(cols * sizeof(float));
+    float* logits = malloc(vocab_size * sizeof(float));
+    int idx[MAX_TOP_K], ref_idx[MAX_TOP_K];
+    float val[MAX_TOP_K], ref_val[MAX_TOP_K];
+    for (int i = 0; i < cols; i++) h[i] = (float)rand() / RAND_MAX;
+
+    printf("output projection + top-k (vocab %d): microseconds per call\n", vocab_size);
+    for (int t = 0; t < 2; t++) {
+        int k = ks[t];
+        double us[2];
+        for (int m = 0; m < 2; m++) {
+            long reps = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                if (m == 0) materialized_top_k(h, logits, k, ref_idx, ref_val);
+                else output_top_k(h, k, 0, idx, val);
+                reps++;
+                elapsed = now_seconds() - start;
+            } while (elapsed < 0.3);
+            us[m] = 1e6 * elapsed / reps;
+        }
+        // Same set of candidates?
+        int same = 0;
+        for (int a = 0; a < k; a++)
+            for (int b = 0; b < k; b++)
+                if (idx[a] == ref_idx[b]) same++;
+        printf("  k=%-3d materialized %.2f  fused %.2f  (%.2fx, %d/%d candidates agree)\n",
+               k, us[0], us[1], us[0] / us[1], same, k);
+        record("us", us[0], "output_top_k.k%d.materialized", k);
+        record("us", us[1], "output_top_k.k%d.fused", k);
+    }
+    free(h);
+    free(logits);
+}
+
+// Per-unit rand_r coin flips, the way dropout used to be drawn
+static void reference_dropout(float* v, int size, float rate, unsigned int* seed) {
+    float inv_keep_prob = 1.0f / (1.0f - rate);
+    for (int i = 0; i < size; i++) {
+        if (v[i] < 0) v[i] = 0;
+        if ((float)rand_r(seed) / RAND_MAX < rate) v[i] = 0;
+        else v[i] *= inv_keep_prob;
+    }
+}
+
+// ReLU + dropout over one layer-0 activation vector
+static void bench_dropout() {
+    const float rates[] = { DROPOUT_RATE, 0.5f };
+    int size = hidden_sizes[0];
+    float* v = malloc(size * sizeof(float));
+    unsigned int seed = BENCH_SEED;
+    uint64_t rng = rng_seed(BENCH_SEED);
+
+    printf("relu + dropout (%d units): nanoseconds per unit\n", size);
+    for (int r = 0; r < 2; r++) {
+        double ns[2];
+        long dropped = 0, units = 0;
+        for (int m = 0; m < 2; m++) {
+            long reps = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                for (int i = 0; i < size; i++) v[i] = 1.0f;
+                if (m == 0) reference_dropout(v, size, rates[r], &seed);
+                else relu_and_dropout_combined(v, size, rates[r], &rng);
+                reps++;
+                elapsed = now_seconds() - start;
+            } while (elapsed < 0.3);
+            ns[m] = 1e9 * elapsed / ((double)reps * size);
+        }
+        for (int k = 0; k < 2000; k++) {
+            for (int i = 0; i < size; i++) v[i] = 1.0f;
+            relu_and_dropout_combined(v, size, rates[r], &rng);
+            for (int i = 0; i < size; i++) dropped += v[i] == 0.0f;
+            units += size;
+        }
+        printf("  rate %-7g rand_r %.2f  rng %.2f  (%.1fx, measured rate %.5f)\n",
+               rates[r], ns[0], ns[1], ns[0] / ns[1], (double)dropped / units);
+        record("ns", ns[0], "dropout.r%g.rand_r", rates[r]);
+        record("ns", ns[1], "dropout.r%g.rng", rates[r]);
+    }
+    free(v);
+}
+
+// Layer 0 the direct way: position-weighted input, then the W[0] matvec
+static void layer0_matvec(const int* context, float* x, float* out) {
+    memset(x, 0, MAX_EMBED * sizeof(float));
+    for (int p = 0; p < MAX_CONTEXT; p++) {
+        float w = 1.0f - (float)p / MAX_CONTEXT * POSITIONAL_DECAY_RATE;
+        for (int j = 0; j < MAX_EMBED; j++) x[j] += w * (embed[context[p]][j] + pos_embed[p][j]);
+    }
+    fast_matmul(W[0], x, out, hidden_sizes[0], MAX_EMBED);
+}
+
+// Per-context cost of predict() against predict_batch at several batch
+// sizes, on randomly initialized weights over the corpus vocabulary
+static void bench_predict_batch() {
+    const int batches[] = { 1, 8, 16, 64 };
+    const int total = 256;
+    int* ctx = malloc((size_t)total * MAX_CONTEXT * sizeof(int));
+    const int* ctx_ptr[256];
+    int lens[256], out[256];
+    for (int i = 0; i < total; i++) {
+        for (int p = 0; p < MAX_CONTEXT; p++) ctx[i * MAX_CONTEXT + p] = rand() % vocab_size;
+        ctx_ptr[i] = &ctx[i * MAX_CONTEXT];
+        lens[i] = MAX_CONTEXT;
+    }
+    brook_session* session = brook_session_create(BENCH_SEED);
+
+    printf("predict (vocab %d): microseconds per context\n", vocab_size);
+    long reps = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int i = 0; i < total; i++) out[i] = predict(session, &ctx[i * MAX_CONTEXT], MAX_CONTEXT);
+        reps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < 0.5);
+    double single = 1e6 * elapsed / (reps * total);
+    printf("  predict        %.2f\n", single);
+    record("us", single, "predict.mean");
+    for (int b = 0; b < 4; b++) {
+        reps = 0;
+        start = now_seconds();
+        do {
+            for (int i = 0; i < total; i += batches[b])
+                predict_batch(session, &ctx_ptr[i], &lens[i], batches[b], NULL, NULL, &out[i], NULL);
+            reps++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < 0.5);
+        double per = 1e6 * elapsed / (reps * total);
+        printf("  batch %-3d      %.2f  (%.1fx)\n", batches[b], per, single / per);
+        record("us", per, "predict_batch.b%d", batches[b]);
+    }
+
+    // Batched logits against the single-context path
+    float* batch_logits = malloc((size_t)64 * vocab_size * sizeof(float));
+    float* ref = malloc(vocab_size * sizeof(float));
+    predict_batch(session, ctx_ptr, lens, 64, NULL, NULL, NULL, batch_logits);
+    float max_err = 0.0f;
+    for (int i = 0; i < 64; i++) {
+        context_logits(session, ctx_ptr[i], MAX_CONTEXT, ref, 0);
+        for (int j = 0; j < vocab_size; j++) {
+            float err = fabsf(batch_logits[(size_t)i * vocab_size + j] - ref[j]);
+            if (err > max_err) max_err = err;
+        }
+    }
+    printf("  max logit diff vs predict: %.1e\n", max_err);
+
+    // Layer 0 from the projection table instead of the W[0] matvec
+    float* proj_logits = malloc(vocab_size * sizeof(float));
+    float x0[MAX_EMBED];
+    float* h0 = malloc(hidden_sizes[0] * sizeof(float));
+    double rate[2];
+    build_projection();
+    for (int k = 0; k < 2; k++) {
+        reps = 0;
+        start = now_seconds();
+        do {
+            for (int i = 0; i < total; i++) {
+                if (k) project_context(ctx_ptr[i], MAX_CONTEXT, h0);
+                else layer0_matvec(ctx_ptr[i], x0, h0);
+            }
+            reps++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < 0.5);
+        rate[k] = 1e6 * elapsed / (reps * total);
+    }
+    max_err = 0.0f;
+    for (int i = 0; i < 64; i++) {
+        use_projection = 0;
+        context_logits(session, ctx_ptr[i], MAX_CONTEXT, ref, 0);
+        use_projection = 1;
+        context_logits(session, ctx_ptr[i], MAX_CONTEXT, proj_logits, 0);
+        for (int j = 0; j < vocab_size; j++) {
+            float err = fabsf(proj_logits[j] - ref[j]);
+            if (err > max_err) max_err = err;
+        }
+    }
+    use_projection = 0;
+    printf("layer 0 per context: matvec %.2fus, projection table %.2fus (%.1fx, max logit diff %.1e)\n",
+           rate[0], rate[1], rate[0] / rate[1], max_err);
+    record("us", rate[0], "layer0.matvec");
+    record("us", rate[1], "layer0.projection");
+    free(proj_logits);
+    free(h0);
+    free(batch_logits);
+    free(ref);
+    brook_session_free(session);
+    free(ctx);
+}
+
+typedef struct {
+    uint64_t seed;
+    int steps;
+    double seconds;
+    char text[2048];
+} generate_job;
+
+static void* generate_worker(void* arg) {
+    generate_job* job = arg;
+    brook_session* session = brook_session_create(job->seed);
+    double start = now_seconds();
+    generate_text(session, "the", job->steps, job->text, sizeof(job->text));
+    job->seconds = now_seconds() - start;
+    brook_session_free(session);
+    return NULL;
+}
+
+// Concurrent generation: one session per thread over the shared weights.
+// Threads given the same seed must produce the same text as a single
+// session run alone with that seed.
+static void bench_sessions() {
+    const int counts[] = { 1, 2, 4, 8 };
+    const int steps = 2000;
+    generate_job jobs[8];
+    pthread_t threads[8];
+    generate_job ref = { .seed = BENCH_SEED, .steps = steps };
+    generate_worker(&ref);
+    printf("concurrent sessions (%d words each): words/s total\n", steps);
+    for (int c = 0; c < 4; c++) {
+        int n = counts[c], same = 1;
+        double start = now_seconds();
+        for (int t = 0; t < n; t++) {
+            jobs[t].seed = BENCH_SEED;
+            jobs[t].steps = steps;
+            pthread_create(&threads[t], NULL, generate_worker, &jobs[t]);
+        }
+        for (int t = 0; t < n; t++) pthread_join(threads[t], NULL);
+        double elapsed = now_seconds() - start;
+        for (int t = 0; t < n; t++) same &= strcmp(jobs[t].text, ref.text) == 0;
+        printf("  %d thread%s  %10.0f  (%s)\n", n, n > 1 ? "s" : " ", n * steps / elapsed,
+               same ? "identical to a lone session" : "MISMATCH");
+        record("words/s", n * steps / elapsed, "sessions.t%d", n);
+    }
+}
+
+// Beam search decoding speed: generated tokens per second for beam widths
+// 1-16, each step one predict_batch over the live beams
+static void bench_beam() {
+    const int widths[] = { 1, 2, 4, 8, 16 };
+    const int steps = 64;
+    char text[4096];
+    brook_session* session = brook_session_create(BENCH_SEED);
+    printf("beam search (%d words): tokens/s\n", steps);
+    for (int w = 0; w < 5; w++) {
+        long reps = 0;
+        double start = now_seconds(), elapsed;
+        do {
+            generate_beam(session, "the", steps, widths[w], text, sizeof(text));
+            reps++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < 0.5);
+        printf("  width %-2d  %8.0f tokens/s  (%.0f beam tokens/s)\n", widths[w],
+               reps * steps / elapsed, (double)reps * steps * widths[w] / elapsed);
+        record("tokens/s", reps * steps / elapsed, "beam.w%d", widths[w]);
+    }
+    brook_session_free(session);
+}
+
+// forward_pass, backward_pass and update_weights per sample on the
+// training corpus (single worker, full softmax, SGD)
+static void bench_train_step() {
+    double times[3];
+    int samples = train_step_times(BENCH_TRAIN_SAMPLES, times);
+    printf("training step (%d samples, vocab %d): microseconds per sample\n", samples, vocab_size);
+    printf("  forward %.2f  backward %.2f  update %.2f\n", 1e6 * times[0], 1e6 * times[1], 1e6 * times[2]);
+    record("us", 1e6 * times[0], "train.forward");
+    record("us", 1e6 * times[1], "train.backward");
+    record("us", 1e6 * times[2], "train.update");
+}
+
+// Latency distribution of single predict() calls over corpus contexts
+static void bench_predict_latency() {
+    int ctx = context_window > MAX_CONTEXT ? MAX_CONTEXT : context_window;
+    int samples = token_count - ctx;
+    if (samples > BENCH_PREDICT_SAMPLES) samples = BENCH_PREDICT_SAMPLES;
+    if (samples <= 0) return;
+    double* latency = malloc(samples * sizeof(double));
+    brook_session* session = brook_session_create(BENCH_SEED);
+    volatile int sink = 0;
+    for (int i = 0; i < samples; i++) {
+        double start = now_seconds();
+        sink += predict(session, &tokens[i], ctx);
+        latency[i] = 1e6 * (now_seconds() - start);
+    }
+    (void)sink;
+    double p50 = percentile(latency, samples, 0.50);
+    double p90 = percentile(latency, samples, 0.90);
+    double p99 = percentile(latency, samples, 0.99);
+    printf("predict latency (%d corpus contexts): p50 %.2fus  p90 %.2fus  p99 %.2fus\n", samples, p50, p90, p99);
+    record("us", p50, "predict.p50");
+    record("us", p90, "predict.p90");
+    record("us", p99, "predict.p99");
+    brook_session_free(session);
+    free(latency);
+}
+
+int main(int argc, char* argv[]) {
+    const char* json_path = NULL;
+    const char* label = "";
+    const char* corpora[64];
+    int num_corpora = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) label = argv[++i];
+        else if (num_corpora < 64) corpora[num_corpora++] = argv[i];
+    }
+    if (num_corpora == 0) corpora[num_corpora++] = "data/story.txt";
+    srand(BENCH_SEED);
+    train_seed = BENCH_SEED;
+
+    for (int i = 0; i < num_corpora; i++) bench_tokenizer(corpora[i]);
+    bench_kernels();
+    bench_backward_deltas();
+
+    // Model on the first corpus for the training and inference benchmarks
+    init_vocab();
+    initialize_weights();
+    if (!load_training_data(corpora[0])) return 1;
+    bench_train_step();
+    bench_predict_latency();
+    bench_predict_batch();
+    bench_sessions();
+    bench_beam();
+    bench_output_top_k();
+    bench_dropout();
+    cleanup();
+    if (json_path && !write_json(json_path, label)) return 1;
+    return 0;
+}
@@ -2,7 +2,10 @@
 #include "brook.h"
 
 int main(int argc, char* argv[]) {
-    srand(time(NULL));
+    // brook load: the load generator needs no model
+    if (argc > 1 && strcmp(argv[1], "load") == 0) return load_main(argc - 2, argv + 2);
+    const char* seed = getenv("BROOK_SEED");
+    if (seed) train_seed = strtoull(seed, NULL, 10);
     init_vocab();
     initialize_weights();
     if (load_model())
@@ -15,6 +18,11 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 	print_model_info();
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        int status = serve_main(argc - 2, argv + 2);
+        cleanup();
+        return status;
+    }
     interactive_mode();
     cleanup();
     return 0;
@@ -5,18 +5,19 @@
 #include <time.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 
 // Model architecture constants
 #define MAX_VOCAB 5100
 #define MAX_VOCAB_WORD_LEN 16
-#define MAX_TOKENS 64000
 #define MAX_EMBED 32
 #define MAX_HIDDEN_LAYERS 5
-#define OUTPUT_SIZE MAX_VOCAB  // Match the actual vocabulary size
+#define MIN_VOCAB_ROWS 64      // embed/W_output start here and grow with the vocabulary
 #define CONTEXT_SIZE 8
 #define MIN_CONTEXT 1
 #define MAX_CONTEXT 8
-#define MAX_FILE_SIZE 300000
+#define LOAD_CHUNK_SIZE (1 << 20)  // bytes read per step when streaming a corpus
 #define MAX_EPOCHS 10000
 
 #define DEBUG 0
@@ -25,8 +26,101 @@
 #define LEARNING_RATE 0.001f
 #define DECAY_RATE 0.996f
 #define EPOCHS 10
+#define MAX_BATCH_SIZE 1024    // upper bound for "train N B" mini-batches
+#define MAX_THREADS 256        // upper bound for data-parallel training threads
+#define DEFAULT_NEGATIVES 64   // noise samples per step for sampled softmax
+#define MAX_NEGATIVES 1024
+#define NEGATIVE_REDRAWS 8       // draws per negative before a slot hitting the target is dropped
+#define UNIGRAM_TABLE_SIZE (1 << 20)
+
+// Output layer training modes
+#define SOFTMAX_FULL 0
+#define SOFTMAX_SAMPLED 1
+#define SOFTMAX_TREE 2         // hierarchical softmax over a Huffman tree
+#define TREE_MAGIC 0x54524B42  // "BKRT", tree.bin header
+
+// Training precision: bf16 keeps fp32 master weights and gradients but
+// runs the forward/backward matrix kernels on bf16 weight copies
+#define PRECISION_FP32 0
+#define PRECISION_BF16 1
+
+// Optimizers (optim.c)
+#define OPTIMIZER_SGD 0        // clipped SGD
+#define OPTIMIZER_ADAM 1
+#define OPTIMIZER_ADAMW 2      // Adam with decoupled weight decay
+#define ADAM_LEARNING_RATE 0.005f
+#define ADAM_BETA1 0.9f
+#define ADAM_BETA2 0.999f
+#define ADAM_EPSILON 1e-8f
+#define ADAMW_WEIGHT_DECAY 0.01f
+#define OPTIM_MAGIC 0x504F5242 // "BROP", optim.bin header
+
+// Int8 inference (quant.c)
+#define QUANT_MAGIC 0x38515242 // "BRQ8", weights.q8 header
+#define QUANT_EVAL_SAMPLES 2000 // windows compared by the quantize report
+
+// Contexts per GEMM block in predict_batch (predict.c)
+#define PREDICT_BATCH_ROWS 64
+
+// Parameter tensors with Adam moments: 0..num_hidden_layers-1 are W[]
+#define ADAM_OUTPUT MAX_HIDDEN_LAYERS
+#define ADAM_EMBED (MAX_HIDDEN_LAYERS + 1)
+#define ADAM_POS (MAX_HIDDEN_LAYERS + 2)
+#define ADAM_TREE (MAX_HIDDEN_LAYERS + 3)
+#define ADAM_TENSORS (MAX_HIDDEN_LAYERS + 4)
 #define TEMPERATURE 1.01f      // Increase from 1.0f to add diversity
+#define DEFAULT_TOP_K 5        // sampling candidates kept by predict
+#define MAX_TOP_K 256
+#define OUTPUT_TILE 64         // output rows per fused projection + top-k step
+#define MASKED_LOGIT -1e30f    // logit of a banned token (finite: built with -ffast-math)
+#define GENERATOR_MASKED 2     // most ids generator_masked returns
+#define MAX_BEAM_WIDTH 16
+
+// Approximate top-k over W_output rows (mips.c)
+#define MIPS_MAX_LISTS 256
+#define MIPS_KMEANS_ITERS 10
+// Of the lists, when mips_nprobe is 0. From "mips report" on the bundled
+// model (4270 rows, 65 lists): 8 probes give recall@10 79% at 8x exact
+// speed, 16 give 85% at 4x, 32 give 93% at 2x
+#define MIPS_DEFAULT_PROBE_FRACTION 0.25f
+#define MIPS_EVAL_SAMPLES 2000
+
+// Inference server and load generator (server.c, loadgen.c)
+#define SERVE_DEFAULT_ADDRESS "brook.sock"
+#define SERVE_DEFAULT_BATCH 32         // requests per batched forward pass
+#define SERVE_DEFAULT_WAIT_MS 2        // how long a lone request waits for company
+#define SERVE_MAX_BATCH 1024
+#define SERVE_MAX_STEPS 256            // words per generate request
+#define SERVE_MAX_SCORE 256            // tokens per score request
+#define SERVE_MAX_TEXT 8192
+#define SERVE_SCORE_ROWS 256           // score positions per predict_batch call
+#define SERVE_LINE 4096
+#define SERVE_BACKLOG 128
+#define SERVE_LATENCY_SAMPLES 65536
+#define LOAD_DEFAULT_CLIENTS 8
+#define LOAD_DEFAULT_REQUESTS 50
+#define LOAD_DEFAULT_STEPS 16
+
+// Training profiler slots (prof.c): phases, then per-layer forward and
+// backward work, where layer MAX_HIDDEN_LAYERS is the output layer
+#define PROF_FORWARD 0
+#define PROF_SOFTMAX 1         // softmax and loss, or the sampled/tree output step
+#define PROF_BACKWARD 2
+#define PROF_REDUCE 3          // barrier wait and cross-thread gradient sums
+#define PROF_UPDATE 4
+#define PROF_EPOCH 5
+#define PROF_LAYER_FWD 6
+#define PROF_LAYER_BWD (PROF_LAYER_FWD + MAX_HIDDEN_LAYERS + 1)
+#define PROF_SLOTS (PROF_LAYER_BWD + MAX_HIDDEN_LAYERS + 1)
+#define PROF_TRACE_MAX_EVENTS (1 << 21)   // per thread, for one traced epoch
+
+// brook_bench (bench.c)
+#define BENCH_SEED 12345               // srand, training and session seed, so runs compare
+#define BENCH_MAX_RESULTS 256
+#define BENCH_TRAIN_SAMPLES 500        // training steps timed
+#define BENCH_PREDICT_SAMPLES 2000     // predict() calls timed one by one
 #define DROPOUT_RATE 0.0001f
+#define DROPOUT_SPARSE_RATE 0.0625f    // below: draw gaps between drops, not per-unit coins
 #define POSITIONAL_DECAY_RATE 0.3f
 
 // Weight Access Macros
@@ -38,10 +132,53 @@ extern int hidden_sizes[MAX_HIDDEN_LAYERS];
 extern int context_window;
 extern char vocab[MAX_VOCAB][MAX_VOCAB_WORD_LEN];
 extern int vocab_size;
-extern int tokens[MAX_TOKENS];
+extern int* tokens;
 extern int token_count;
+extern int token_capacity;
 extern float learning_rate;
-extern float embed[MAX_VOCAB][MAX_EMBED];
+extern int batch_size;
+extern int num_threads;
+extern int softmax_mode;
+extern int num_negatives;
+extern int precision_mode;
+extern int optimizer_type;
+extern float adam_lr;
+extern float weight_decay;
+extern int adam_step;
+extern int epochs_trained;
+extern uint64_t train_seed;
+extern int use_projection;
+extern int use_mips;
+extern int mips_nprobe;
+extern int sample_top_k;
+extern float sample_top_p;
+extern float sample_temperature;
+extern int freeze_embeddings;
+extern int beam_width;
+extern float initial_lr;
+extern float current_lr;
+
+// Int8 quantized weights (quant.c)
+extern int quant_ready;
+extern int use_quantized;
+extern int8_t* Wq[MAX_HIDDEN_LAYERS];
+extern float* Wq_scale[MAX_HIDDEN_LAYERS];
+extern int8_t* Wq_output;
+extern float* Wq_output_scale;
+extern int quant_vocab_size;
+
+// Hierarchical softmax tree (tree.c)
+extern int tree_ready;
+extern int tree_vocab_size;
+extern int tree_hidden_size;
+extern int tree_max_depth;
+extern float* W_tree;
+extern int* tree_child;
+extern int* tree_path_offset;
+extern int* tree_path_node;
+extern unsigned char* tree_path_bit;
+extern float (*embed)[MAX_EMBED];   // vocab_capacity rows
+extern int vocab_capacity;
 extern float pos_embed[MAX_CONTEXT][MAX_EMBED];
 extern float* W[MAX_HIDDEN_LAYERS];
 extern float* W_output;
@@ -52,34 +189,273 @@ void he_init(float* W, int fan_in, int fan_out);
 int get_loaded_weights();
 void set_loaded_weights();
 int get_token_id(const char* word);
+typedef int (*token_lookup_fn)(const char*);
+
+// Incremental tokenizer state carried across chunk boundaries
+typedef struct {
+    char buf[MAX_VOCAB_WORD_LEN];
+    int len;
+} token_reader;
+
+// Per-thread inference state (predict.c). The model weights are shared
+// read-only; a session owns everything predict writes, so concurrent
+// sessions need no locking on the hot path.
+typedef struct {
+    int num_layers;
+    float* x;                            // MAX_EMBED input
+    float* h[MAX_HIDDEN_LAYERS];         // activations per hidden layer
+    int8_t* xq;                          // int8 input scratch, largest layer input
+    float* batch_x;                      // predict_batch buffers, allocated on first use
+    float* batch_h[MAX_HIDDEN_LAYERS];
+    float* batch_logits;
+    float* tree_logp;                    // 2 x vocab: inner-node scores and log-probs
+    int batch_logits_cols;               // vocab size batch_logits and tree_logp fit
+    int top_k;                           // sampling settings
+    float top_p;
+    float temperature;
+    uint64_t rng;                        // xorshift64* state, never 0
+} brook_session;
+
+// Text generation from a seed (interface.c): the sliding context, the
+// anti-repetition state and the text written so far
+typedef struct {
+    int context[MAX_CONTEXT];
+    int context_len;
+    int last_token;
+    int words;
+    int step;
+    char* out;
+    size_t out_size;
+    size_t len;
+} text_generator;
+
+// splitmix64 of seed, so nearby seeds give unrelated streams
+static inline uint64_t rng_seed(uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+// xorshift64*: a few cycles per draw, state local to the caller
+static inline uint64_t rng_next(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform float in [0, 1) from the top 24 bits
+static inline float rng_float(uint64_t* state) {
+    return (float)(rng_next(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+void token_reader_init(token_reader* r);
+int tokenize_chunk(token_reader* r, const char* data, size_t len);
+int tokenize_finish(token_reader* r);
+int tokens_push(int id);
+void tokens_clear();
+void vocab_index_rebuild();
+void tokenize_generic(const char* text, int* out_tokens, int* out_count, int max_tokens, token_lookup_fn lookup);
 void tokenize(const char* text);
 void allocate_weights();
+void resize_vocab_rows(int rows);
+void ensure_vocab_capacity(int rows);
 void free_weights();
+void make_weights_writable();
+int verify_model();
 void initialize_weights();
-void relu_and_dropout_combined(float* v, int size, float dropout_rate, int training);
-int predict(int* context, int context_len);
+float init_random();
+void relu_and_dropout_combined(float* v, int size, float dropout_rate, uint64_t* rng);
+brook_session* brook_session_create(uint64_t seed);
+void brook_session_free(brook_session* s);
+int predict(brook_session* s, const int* context, int context_len);
+int predict_masked(brook_session* s, const int* context, int context_len, const int* masked, int n_masked);
+int context_logits(brook_session* s, const int* context, int context_len, float* logits, int quantized);
+int output_top_k(const float* h, int k, int approx, int* idx, float* val);
+const float* context_hidden(brook_session* s, const int* context, int context_len);
+void predict_batch(brook_session* s, const int* const* contexts, const int* context_lens, int n,
+                   const int* masked, const int* n_masked, int* out_tokens, float* logits);
 void train(int max_context, int epochs);
+int train_step_times(int samples, double times[3]);   // brook_bench only: mutates the model
+uint64_t training_seed();
+float scheduled_lr(int epoch);
+double prof_add(int thread, int slot, double start, double flops);
+void prof_reset();
+void prof_trace_next_epoch(const char* path);
+void prof_epoch_begin(int samples, int threads);
+void prof_epoch_end(int epoch, int samples, double start);
+void prof_report();
 void save_model();
+void write_model(FILE* f);
+void write_vocab(FILE* f);
 int load_model();
-void generate_text_from_seed(const char* seed_string, int steps);
+void generator_begin(text_generator* g, const char* seed_string, char* out, size_t out_size);
+void generator_push(text_generator* g, int next);
+int generator_masked(const text_generator* g, int masked[GENERATOR_MASKED]);
+size_t generator_finish(text_generator* g);
+size_t generate_beam(brook_session* session, const char* seed_string, int steps, int width,
+                     char* out, size_t out_size);
+size_t generate_text(brook_session* session, const char* seed_string, int steps, char* out, size_t out_size);
+void generate_text_from_seed(brook_session* session, const char* seed_string, int steps);
+int serve_main(int argc, char* argv[]);
+int serve_connect(const char* address);
+double percentile(double* v, int n, double p);
+int load_main(int argc, char* argv[]);
 void generate_sentences(const char* seed_string, int num_sentences);
 void interactive_mode();
 int load_training_data(const char* filename);
 void init_vocab();
 void cleanup();
 void to_lowercase(char* s);
+double now_seconds();
 int token_lookup_existing(const char* word);
 int token_lookup_add(const char* word);
 void to_lowercase(char* s);
 void to_lowercase(char* s);
 void tokenize_user_input(const char* text, int* out_tokens, int* out_count, int max_tokens);
 void relu(float* x, int size);
+
+// bfloat16: the top 16 bits of an IEEE float (same exponent range)
+typedef uint16_t bf16;
+
+static inline bf16 float_to_bf16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);  // round to nearest even
+    return (bf16)(u >> 16);
+}
+
+static inline float bf16_to_float(bf16 b) {
+    uint32_t u = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// One Adam/AdamW step's hyperparameters, shared by every tensor
+typedef struct {
+    float lr, beta1, beta2, eps;
+    float clip;           // gradients are clamped to [-clip, clip]
+    float bias1, bias2;   // bias corrections 1 / (1 - beta^t)
+    float decay;          // decoupled weight decay lr * wd (AdamW), 0 for Adam
+} adam_params;
+
+// Vector kernels, selected at startup for the host CPU (simd.c)
+typedef struct {
+    const char* name;
+    float (*dot)(const float * restrict a, const float * restrict b, int n);
+    void (*matvec)(const float * restrict W, const float * restrict x,
+                   float * restrict out, int rows, int cols);
+    void (*axpy)(float alpha, const float * restrict x, float * restrict y, int n);  // y += alpha * x
+    float (*max)(const float* x, int n);
+    float (*exp_sum)(float* x, int n, float shift);  // x = exp(x - shift), returns sum
+    void (*scale)(float* x, int n, float s);
+    void (*adam)(float * restrict w, const float * restrict g, float * restrict m,
+                 float * restrict v, int n, const adam_params* p);
+    int (*dot_i8)(const int8_t * restrict a, const int8_t * restrict b, int n);
+    // bf16 weights, fp32 vectors and accumulation
+    void (*matvec_bf16)(const bf16 * restrict W, const float * restrict x,
+                        float * restrict out, int rows, int cols);
+    void (*axpy_bf16)(float alpha, const bf16 * restrict x, float * restrict y, int n);
+    // C[i][j] = A[i] . B[j] for row-major A[M][K], B[N][K]; C rows ldc apart
+    void (*gemm_nt)(const float * restrict A, const float * restrict B,
+                    float * restrict C, int M, int N, int K, int ldc);
+} simd_kernels;
+
+extern const simd_kernels* simd;
+void simd_init();
+int simd_select(const char* name);
+
+// Weight rows and activation vectors start on cache-line boundaries
+#define SIMD_ALIGN 64
+void* alloc_aligned(size_t bytes);
+void* calloc_aligned(size_t count, size_t size);
+void* realloc_aligned(void* p, size_t old_bytes, size_t new_bytes);
+
 void fast_matmul(const float * restrict W,
                  const float * restrict x,
                  float * restrict out,
                  int out_size,
                  int in_size);
+void fast_matmul_t(const float * restrict W,
+                   const float * restrict x,
+                   float * restrict out,
+                   int out_size,
+                   int in_size);
+void fast_matmul_bf16(const bf16 * restrict W,
+                      const float * restrict x,
+                      float * restrict out,
+                      int out_size,
+                      int in_size);
+void fast_matmul_t_bf16(const bf16 * restrict W,
+                        const float * restrict x,
+                        float * restrict out,
+                        int out_size,
+                        int in_size);
+void fast_gemm_nt_bf16(const float * restrict A,
+                       const bf16 * restrict B,
+                       float * restrict C,
+                       int M, int N, int K);
+void fast_gemm_nn_bf16(const float * restrict A,
+                       const bf16 * restrict B,
+                       float * restrict C,
+                       int M, int N, int K);
+void fast_gemm_nt(const float * restrict A,
+                  const float * restrict B,
+                  float * restrict C,
+                  int M, int N, int K);
+void fast_gemm_nn(const float * restrict A,
+                  const float * restrict B,
+                  float * restrict C,
+                  int M, int N, int K);
+void fast_gemm_tn_acc(const float * restrict A,
+                      const float * restrict B,
+                      float * restrict C,
+                      int M, int N, int K);
 void init_weights();
+const char* optimizer_name();
+void adam_begin_step(float lr);
+void adam_update(int tensor, float* param, const float* grad, size_t offset, int n);
+void free_optim();
+void write_optim(FILE* f);
+int load_optim();
+void quantize_model();
+void free_quantized();
+void quant_matvec(const int8_t* q, const float* scale, const float* x, int8_t* xq,
+                  float* out, int rows, int cols);
+void save_quantized();
+void write_quantized(FILE* f);
+int load_quantized();
+void quant_report();
+void build_tree(int hidden_size);
+void free_tree();
+int tree_sample(const float* h, float temperature, uint64_t* rng);
+void tree_log_probs(const float* z, float* inner, float* logp);
+int tree_in_use();
+void write_tree(FILE* f);
+int load_tree();
+void build_projection();
+void invalidate_projection();
+void free_projection();
+int projection_current();
+void project_context(const int* context, int len, float* out);
+void build_mips_index();
+void invalidate_mips();
+void free_mips();
+int mips_current();
+int mips_probe_count();
+int mips_probe(const float* h, int nprobe, int* lists);
+int mips_list(int list, const float** rows, const int** ids);
+void mips_report();
+extern uint32_t checkpoint_id;
+void checkpoint_async();
+void checkpoint_wait();
+int save_checkpoint();
+int save_file(const char* path, void (*serialize)(FILE*));
 long long count_parameters();
 void print_model_info();
 
@@ -0,0 +1,185 @@
+// Crash-safe and asynchronous model saving.
+// Every artifact (weights.bin, vocab.txt, tree.bin, optim.bin and, when
+// current, weights.q8) is first serialized into memory, then written to
+// "<name>.tmp", fsync'ed and renamed over the old file, so a crash leaves
+// either the previous or the new file, never a torn one. Every snapshot
+// also gets a fresh checkpoint id, stored in weights.bin, tree.bin,
+// optim.bin and weights.q8; on load a tree, optimizer or int8 file whose
+// id differs from weights.bin's is refused, so neither a crash between
+// the renames nor a weights.q8 left over from before the model was
+// retrained can pair weights from one checkpoint with moments, tree
+// vectors or int8 rows from another. During training the serialized
+// snapshot is handed to a background writer thread: the training loop
+// only pays for the in-memory copy, not for the disk. Two snapshot slots
+// alternate so the next snapshot can be taken while the previous one is
+// still being written; a new writer starts only after the previous one
+// has finished, which keeps checkpoints landing on disk in order.
+#include "brook.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define CHECKPOINT_FILES 5
+
+typedef struct {
+    const char* path;
+    char* data;                  // open_memstream buffer
+    size_t size;
+} checkpoint_file;
+
+typedef struct {
+    checkpoint_file files[CHECKPOINT_FILES];
+    int count;
+    int epoch;
+    int ok;                      // set by the writer
+} checkpoint;
+
+uint32_t checkpoint_id = 0;      // of the weights.bin loaded or last written; 0 = untagged
+                                 // or trained since
+
+static checkpoint slots[2];
+static int next_slot = 0;
+static checkpoint* in_flight = NULL;
+static pthread_t writer;
+
+static void snapshot_file(checkpoint* c, const char* path, void (*serialize)(FILE*)) {
+    checkpoint_file* cf = &c->files[c->count++];
+    cf->path = path;
+    cf->data = NULL;
+    cf->size = 0;
+    FILE* f = open_memstream(&cf->data, &cf->size);
+    if (!f) {
+        printf("Error: Could not allocate checkpoint buffer for %s\n", path);
+        exit(1);
+    }
+    serialize(f);
+    if (fclose(f) != 0) {
+        printf("Error: Could not allocate checkpoint buffer for %s\n", path);
+        exit(1);
+    }
+}
+
+// Serializes the current model state. Must run on the training thread,
+// between weight updates.
+static void take_snapshot(checkpoint* c) {
+    static uint64_t id_rng = 0;
+    if (!id_rng) id_rng = rng_seed((uint64_t)time(NULL) ^ (uint64_t)getpid() << 32);
+    do checkpoint_id = (uint32_t)(rng_next(&id_rng) >> 32); while (checkpoint_id == 0);
+    c->count = 0;
+    c->epoch = epochs_trained;
+    snapshot_file(c, "weights.bin", write_model);
+    snapshot_file(c, "vocab.txt", write_vocab);
+    if (tree_ready) snapshot_file(c, "tree.bin", write_tree);
+    if (optimizer_type != OPTIMIZER_SGD && adam_step > 0) snapshot_file(c, "optim.bin", write_optim);
+    // Training drops the int8 copy, so one that is still here was
+    // quantized from exactly these weights
+    if (quant_ready) snapshot_file(c, "weights.q8", write_quantized);
+}
+
+static int write_atomic(const char* path, const char* data, size_t size) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    int ok = done == size && fsync(fd) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+// Writes every file of a snapshot and releases its buffers
+static int write_checkpoint(checkpoint* c) {
+    int ok = 1;
+    for (int i = 0; i < c->count; i++) {
+        if (!write_atomic(c->files[i].path, c->files[i].data, c->files[i].size)) {
+            ok = 0;
+        }
+        free(c->files[i].data);
+        c->files[i].data = NULL;
+    }
+    c->count = 0;
+    // Make the renames themselves durable
+    int dir = open(".", O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return ok;
+}
+
+static void* checkpoint_thread(void* arg) {
+    checkpoint* c = arg;
+    c->ok = write_checkpoint(c);
+    return NULL;
+}
+
+/**
+ * Waits for the background writer, if any, and reports a failed write.
+ * Called before the next checkpoint, before a synchronous save and at exit.
+ */
+void checkpoint_wait() {
+    if (!in_flight) return;
+    pthread_join(writer, NULL);
+    if (!in_flight->ok) {
+        printf("Error: Could not write checkpoint for epoch %d\n", in_flight->epoch);
+    }
+    in_flight = NULL;
+}
+
+/**
+ * Snapshots the model and writes it on a background thread. Training
+ * only waits if the previous checkpoint is still being written.
+ */
+void checkpoint_async() {
+    checkpoint* c = &slots[next_slot];
+    take_snapshot(c);
+    checkpoint_wait();
+    if (pthread_create(&writer, NULL, checkpoint_thread, c) != 0) {
+        // No thread: write it here rather than lose the checkpoint
+        if (!write_checkpoint(c)) printf("Error: Could not write checkpoint for epoch %d\n", c->epoch);
+        return;
+    }
+    in_flight = c;
+    next_slot ^= 1;
+}
+
+/**
+ * Saves the model synchronously through the same crash-safe path.
+ * Returns 1 if every file was written.
+ */
+int save_checkpoint() {
+    checkpoint_wait();
+    checkpoint* c = &slots[next_slot];
+    take_snapshot(c);
+    if (!write_checkpoint(c)) {
+        printf("Error: Could not save the model\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Writes one file crash-safely from a stream writer (used for files that
+ * are not part of a checkpoint, such as weights.q8). Returns 1 on success.
+ */
+int save_file(const char* path, void (*serialize)(FILE*)) {
+    checkpoint c;
+    c.count = 0;
+    snapshot_file(&c, path, serialize);
+    if (!write_checkpoint(&c)) {
+        printf("Error: Could not save %s\n", path);
+        return 0;
+    }
+    return 1;
+}
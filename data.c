@@ -9,12 +9,13 @@ int loaded_weights = 0;
 // Global Data Structures
 char vocab[MAX_VOCAB][MAX_VOCAB_WORD_LEN];
 int vocab_size = 0;
-int tokens[MAX_TOKENS];
+int* tokens = NULL;  // growable token store
 int token_count = 0;
+int token_capacity = 0;
 float learning_rate = LEARNING_RATE;
 
 // Neural Network Parameters
-float embed[MAX_VOCAB][MAX_EMBED];
+float (*embed)[MAX_EMBED] = NULL;
 float pos_embed[MAX_CONTEXT][MAX_EMBED];
 float* W[MAX_HIDDEN_LAYERS];
 float* W_output;
@@ -31,35 +32,80 @@ void set_loaded_weights()
 	loaded_weights = 1;
 }
 
+/**
+ * Appends a token id to the global token store, growing it as needed.
+ * Returns 0 on allocation failure or if the store would overflow.
+ */
+int tokens_push(int id) {
+    if (token_count == token_capacity) {
+        if (token_capacity > INT_MAX / 2) {
+            printf("Error: Token store is full (%d tokens)\n", token_count);
+            return 0;
+        }
+        int new_capacity = token_capacity ? token_capacity * 2 : 65536;
+        int* grown = (int*)realloc(tokens, (size_t)new_capacity * sizeof(int));
+        if (!grown) {
+            printf("Error: Could not grow token store to %d tokens\n", new_capacity);
+            return 0;
+        }
+        tokens = grown;
+        token_capacity = new_capacity;
+    }
+    tokens[token_count++] = id;
+    return 1;
+}
+
+void tokens_clear() {
+    token_count = 0;
+}
+
+/**
+ * Streams a corpus from disk in LOAD_CHUNK_SIZE pieces, tokenizing each
+ * piece as it arrives. Corpus size is limited only by memory for the
+ * token ids, never by the size of the text itself.
+ */
 int load_training_data(const char* filename) {
     FILE* f = fopen(filename, "r");
     if (!f) {
         printf("Error: Could not open %s\n", filename);
         return 0;
     }
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    if (file_size <= 0 || file_size > MAX_FILE_SIZE) {
-        printf("Error: File size %ld is invalid or too large\n", file_size);
-        fclose(f);
-        return 0;
-    }
-    char* text = (char*)malloc(file_size + 1);
-    if (!text) {
+    char* chunk = (char*)malloc(LOAD_CHUNK_SIZE);
+    if (!chunk) {
         printf("Error: Could not allocate memory for training data\n");
         fclose(f);
         return 0;
     }
-    size_t bytes_read = fread(text, 1, file_size, f);
-    text[bytes_read] = '\0';
+
+    token_reader reader;
+    token_reader_init(&reader);
+    tokens_clear();
+
+    size_t total_read = 0, bytes_read;
+    int ok = 1;
+    while (ok && (bytes_read = fread(chunk, 1, LOAD_CHUNK_SIZE, f)) > 0) {
+        total_read += bytes_read;
+        ok = tokenize_chunk(&reader, chunk, bytes_read);
+    }
+    if (ok) ok = tokenize_finish(&reader);
+    if (ferror(f)) {
+        printf("Error: Failed reading %s\n", filename);
+        ok = 0;
+    }
     fclose(f);
+    free(chunk);
 
-    printf("Loaded %zu chars from %s\n", bytes_read, filename);
-    tokenize(text);
-    printf("Tokenized: %d tokens, %d unique words\n", token_count, vocab_size);
+    if (total_read == 0) {
+        printf("Error: %s is empty\n", filename);
+        return 0;
+    }
+    if (!ok) return 0;
 
-    free(text);
+    // New words need embedding and output rows
+    ensure_vocab_capacity(vocab_size);
+
+    printf("Loaded %zu chars from %s\n", total_read, filename);
+    printf("Tokenized: %d tokens, %d unique words\n", token_count, vocab_size);
     return token_count >= 10;
 }
 
@@ -68,5 +114,14 @@ void init_vocab() {
 }
 
 void cleanup() {
+    checkpoint_wait();
     free_weights();
+    free_tree();
+    free_optim();
+    free_quantized();
+    free_projection();
+    free_mips();
+    free(tokens);
+    tokens = NULL;
+    token_count = token_capacity = 0;
 }
@@ -1,48 +1,112 @@
 #include "brook.h"
 
-void generate_text_from_seed(const char* seed_string, int steps) {
+// Appends str to the generator's text, truncating at out_size
+static void generator_append(text_generator* g, const char* str) {
+    size_t n = strlen(str);
+    if (g->len + n >= g->out_size) n = g->out_size - 1 - g->len;
+    memcpy(g->out + g->len, str, n);
+    g->len += n;
+    g->out[g->len] = '\0';
+}
+
+/**
+ * Starts generating from seed_string into out (truncated to out_size,
+ * which must be at least 1). Feed each predicted token of g->context to
+ * generator_push, then call generator_finish.
+ */
+void generator_begin(text_generator* g, const char* seed_string, char* out, size_t out_size) {
     char buffer[1024];
     strncpy(buffer, seed_string, sizeof(buffer));
     buffer[sizeof(buffer) - 1] = '\0';
     to_lowercase(buffer);
+    g->context_len = 0;
+    tokenize_user_input(buffer, g->context, &g->context_len, MAX_CONTEXT);
+    g->last_token = -1;
+    g->words = g->context_len;
+    g->step = 0;
+    g->out = out;
+    g->out_size = out_size;
+    g->len = 0;
+    out[0] = '\0';
+}
 
-    int context[MAX_CONTEXT], context_len = 0;
-    tokenize_user_input(buffer, context, &context_len, MAX_CONTEXT);
+// Appends the next predicted token unless it would repeat, and slides the context
+void generator_push(text_generator* g, int next) {
+    int i = g->step++;
+    int* context = g->context;
+
+    // Anti-repetition: skip if same as last token or if we've seen this pattern recently
+    if (next == g->last_token) return;
+
+    // Check for immediate 2-token loops
+    if (g->context_len >= 2 && next == context[g->context_len-2] && context[g->context_len-1] == g->last_token) {
+        return;  // Skip A-B-A-B patterns
+    }
 
-    int last_token = -1;
-    int words_in_sentence = context_len;
+    if (strcmp(vocab[next], ".") == 0) {
+        if (i != 0) generator_append(g, ". ");
+    } else {
+        if (g->last_token != -1) generator_append(g, " ");
+        generator_append(g, vocab[next]);
+    }
+    g->words++;
+    if (g->context_len == context_window) {
+        for (int j = 0; j < g->context_len - 1; j++)
+            context[j] = context[j + 1];
+        context[g->context_len - 1] = next;
+    } else {
+        context[g->context_len++] = next;
+    }
+    g->last_token = next;
+}
+
+/**
+ * The tokens generator_push would reject as the next token: the last
+ * token, and the one before it when that would start an A-B-A-B loop.
+ * Decoders mask them instead of predicting again. Returns the count.
+ */
+int generator_masked(const text_generator* g, int masked[GENERATOR_MASKED]) {
+    int n = 0;
+    if (g->last_token < 0) return 0;
+    masked[n++] = g->last_token;
+    if (g->context_len >= 2 && g->context[g->context_len-1] == g->last_token)
+        masked[n++] = g->context[g->context_len-2];
+    return n;
+}
+
+// Ends the text with a period; returns its length
+size_t generator_finish(text_generator* g) {
+    if (g->words > 0 && g->last_token != token_lookup_existing(".")) generator_append(g, ".");
+    return g->len;
+}
+
+/**
+ * Generates up to steps words continuing seed_string with session and
+ * writes them to out (truncated to out_size). Reentrant: everything it
+ * writes besides out lives in the session. Returns the text length.
+ */
+size_t generate_text(brook_session* session, const char* seed_string, int steps, char* out, size_t out_size) {
+    text_generator g;
+    if (out_size == 0) return 0;
+    generator_begin(&g, seed_string, out, out_size);
+    int masked[GENERATOR_MASKED];
     for (int i = 0; i < steps; i++) {
-        int next = predict(context, context_len);
-        
-        // Anti-repetition: skip if same as last token or if we've seen this pattern recently
-        if (next == last_token) continue;
-        
-        // Check for immediate 2-token loops
-        if (context_len >= 2 && next == context[context_len-2] && context[context_len-1] == last_token) {
-            continue;  // Skip A-B-A-B patterns
-        }
-        
-        if (strcmp(vocab[next], ".") == 0) {
-            if (i != 0) printf(". ");
-        } else {
-            if (last_token != -1) printf(" ");
-            printf("%s", vocab[next]);
-        }
-        words_in_sentence++;
-        if (context_len == context_window) {
-            for (int j = 0; j < context_len - 1; j++)
-                context[j] = context[j + 1];
-            context[context_len - 1] = next;
-        } else {
-            context[context_len++] = next;
-        }
-        last_token = next;
+        int n = generator_masked(&g, masked);
+        generator_push(&g, predict_masked(session, g.context, g.context_len, masked, n));
     }
-    if (words_in_sentence > 0 && last_token != token_lookup_existing(".")) printf(".");
+    return generator_finish(&g);
+}
+
+void generate_text_from_seed(brook_session* session, const char* seed_string, int steps) {
+    char text[4096];
+    if (beam_width > 1) generate_beam(session, seed_string, steps, beam_width, text, sizeof(text));
+    else generate_text(session, seed_string, steps, text, sizeof(text));
+    printf("%s", text);
 }
 
 void interactive_mode() {
     char input[256] = {0};
+    brook_session* session = brook_session_create(0);
     while (1) {
         printf("> ");
         fflush(stdout);
@@ -60,15 +124,207 @@ void interactive_mode() {
             train(context_window, EPOCHS);
             continue;
         } else if (strncmp(input, "train ", 6) == 0) {
-            int custom_epochs = atoi(input + 6);
-            if (custom_epochs > 0 && custom_epochs <= MAX_EPOCHS) {
-                printf("Training %d-layer network with %d epochs and context window %d...\n",
-                       num_hidden_layers, custom_epochs, context_window);
+            int custom_epochs = 0, custom_batch = batch_size;
+            sscanf(input + 6, "%d %d", &custom_epochs, &custom_batch);
+            if (custom_batch < 1 || custom_batch > MAX_BATCH_SIZE) {
+                printf("Invalid batch size. Use 1-%d\n", MAX_BATCH_SIZE);
+            } else if (custom_epochs > 0 && custom_epochs <= MAX_EPOCHS) {
+                batch_size = custom_batch;
+                printf("Training %d-layer network with %d epochs, batch size %d and context window %d...\n",
+                       num_hidden_layers, custom_epochs, batch_size, context_window);
                 train(context_window, custom_epochs);
             } else {
                 printf("Invalid epoch count. Use 1-%d epochs\n", MAX_EPOCHS);
             }
             continue;
+        } else if (strcmp(input, "threads") == 0 || strncmp(input, "threads ", 8) == 0) {
+            int n = atoi(input + 7);
+            if (n >= 1 && n <= MAX_THREADS) {
+                num_threads = n;
+            } else if (input[7] != '\0') {
+                printf("Invalid thread count. Use 1-%d threads\n", MAX_THREADS);
+            }
+            printf("Training threads: %d\n", num_threads);
+            continue;
+        } else if (strcmp(input, "softmax") == 0 || strncmp(input, "softmax ", 8) == 0) {
+            const char* arg = input + 7;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "full") == 0) {
+                softmax_mode = SOFTMAX_FULL;
+            } else if (strcmp(arg, "tree") == 0) {
+                softmax_mode = SOFTMAX_TREE;
+            } else if (strncmp(arg, "sampled", 7) == 0) {
+                int k = (arg[7] != '\0') ? atoi(arg + 7) : num_negatives;
+                if (k >= 1 && k <= MAX_NEGATIVES) {
+                    softmax_mode = SOFTMAX_SAMPLED;
+                    num_negatives = k;
+                } else {
+                    printf("Invalid negative count. Use 1-%d\n", MAX_NEGATIVES);
+                }
+            } else if (*arg != '\0') {
+                printf("Usage: softmax [full | sampled [K] | tree]\n");
+            }
+            if (softmax_mode == SOFTMAX_SAMPLED)
+                printf("Training softmax: sampled, %d negatives\n", num_negatives);
+            else if (softmax_mode == SOFTMAX_TREE)
+                printf("Softmax: hierarchical (Huffman tree) for training and prediction\n");
+            else
+                printf("Training softmax: full\n");
+            continue;
+        } else if (strcmp(input, "precision") == 0 || strncmp(input, "precision ", 10) == 0) {
+            const char* arg = input + 9;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "fp32") == 0) {
+                precision_mode = PRECISION_FP32;
+            } else if (strcmp(arg, "bf16") == 0) {
+                precision_mode = PRECISION_BF16;
+            } else if (*arg != '\0') {
+                printf("Usage: precision [fp32 | bf16]\n");
+            }
+            printf("Training precision: %s\n", precision_mode == PRECISION_BF16
+                   ? "bf16 weights, fp32 master copy and gradients" : "fp32");
+            continue;
+        } else if (strcmp(input, "optimizer") == 0 || strncmp(input, "optimizer ", 10) == 0) {
+            char name[16] = "";
+            float lr = adam_lr, wd = weight_decay;
+            sscanf(input + 9, "%15s %f %f", name, &lr, &wd);
+            // initial_lr = 0: the next train call bases its schedule on the new rate
+            if (strcmp(name, "sgd") == 0) {
+                optimizer_type = OPTIMIZER_SGD;
+                initial_lr = 0.0f;
+            } else if (strcmp(name, "adam") == 0 || strcmp(name, "adamw") == 0) {
+                if (lr <= 0.0f || wd < 0.0f) {
+                    printf("Invalid learning rate or weight decay\n");
+                } else {
+                    optimizer_type = (name[4] == 'w') ? OPTIMIZER_ADAMW : OPTIMIZER_ADAM;
+                    adam_lr = lr;
+                    weight_decay = wd;
+                    initial_lr = 0.0f;
+                }
+            } else if (name[0] != '\0') {
+                printf("Usage: optimizer [sgd | adam [LR] | adamw [LR [WD]]]\n");
+            }
+            if (optimizer_type == OPTIMIZER_ADAMW)
+                printf("Optimizer: adamw, lr %g, weight decay %g, step %d\n", adam_lr, weight_decay, adam_step);
+            else if (optimizer_type == OPTIMIZER_ADAM)
+                printf("Optimizer: adam, lr %g, step %d\n", adam_lr, adam_step);
+            else
+                printf("Optimizer: sgd, lr %g\n", LEARNING_RATE);
+            continue;
+        } else if (strcmp(input, "quantize") == 0) {
+            quantize_model();
+            save_quantized();
+            printf("Wrote int8 weights to weights.q8\n");
+            quant_report();
+            use_quantized = 1;
+            printf("Inference: int8\n");
+            continue;
+        } else if (strcmp(input, "int8") == 0 || strncmp(input, "int8 ", 5) == 0) {
+            const char* arg = input + 4;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "on") == 0) {
+                if (quant_ready) use_quantized = 1;
+                else printf("No int8 weights; run quantize first\n");
+            } else if (strcmp(arg, "off") == 0) {
+                use_quantized = 0;
+            } else if (strcmp(arg, "report") == 0) {
+                if (quant_ready) quant_report();
+                else printf("No int8 weights; run quantize first\n");
+            } else if (*arg != '\0') {
+                printf("Usage: int8 [on | off | report]\n");
+            }
+            printf("Inference: %s\n", use_quantized ? "int8" : "fp32");
+            continue;
+        } else if (strcmp(input, "sampling") == 0 || strncmp(input, "sampling ", 9) == 0) {
+            int k = sample_top_k;
+            float p = sample_top_p, t = sample_temperature;
+            int n = sscanf(input + 8, "%d %f %f", &k, &p, &t);
+            if (n > 0 && (k < 1 || k > MAX_TOP_K || p <= 0.0f || p > 1.0f || t < 0.0f)) {
+                printf("Usage: sampling [K [P [T]]] with K 1-%d, 0 < P <= 1, T >= 0 (0 is greedy)\n", MAX_TOP_K);
+            } else if (n > 0) {
+                sample_top_k = session->top_k = k;
+                sample_top_p = session->top_p = p;
+                sample_temperature = session->temperature = t;
+            }
+            printf("Sampling: top-k %d, top-p %g, temperature %g\n", sample_top_k, sample_top_p, sample_temperature);
+            continue;
+        } else if (strcmp(input, "beam") == 0 || strncmp(input, "beam ", 5) == 0) {
+            int width = atoi(input + 4);
+            if (width >= 1 && width <= MAX_BEAM_WIDTH) {
+                beam_width = width;
+            } else if (input[4] != '\0') {
+                printf("Invalid beam width. Use 1-%d (1 samples)\n", MAX_BEAM_WIDTH);
+            }
+            if (beam_width > 1) printf("Decoding: beam search, %d beams\n", beam_width);
+            else printf("Decoding: sampling\n");
+            continue;
+        } else if (strcmp(input, "mips") == 0 || strncmp(input, "mips ", 5) == 0) {
+            const char* arg = input + 4;
+            while (*arg == ' ') arg++;
+            if (strncmp(arg, "on", 2) == 0) {
+                int n = atoi(arg + 2);
+                if (n < 0 || n > MIPS_MAX_LISTS) {
+                    printf("Invalid probe count. Use 1-%d lists (0 for the default)\n", MIPS_MAX_LISTS);
+                } else {
+                    mips_nprobe = n;
+                    use_mips = 1;
+                    if (!mips_current()) build_mips_index();
+                }
+            } else if (strcmp(arg, "off") == 0) {
+                use_mips = 0;
+            } else if (strcmp(arg, "report") == 0) {
+                mips_report();
+            } else if (*arg != '\0') {
+                printf("Usage: mips [on [NPROBE] | off | report]\n");
+            }
+            if (use_mips)
+                printf("Top-k: MIPS index, probing %d lists\n", mips_probe_count());
+            else
+                printf("Top-k: exact\n");
+            continue;
+        } else if (strcmp(input, "project") == 0 || strncmp(input, "project ", 8) == 0) {
+            const char* arg = input + 7;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "on") == 0) {
+                use_projection = 1;
+            } else if (strcmp(arg, "off") == 0) {
+                use_projection = 0;
+            } else if (*arg != '\0') {
+                printf("Usage: project [on | off]\n");
+            }
+            printf("Layer 0 inference: %s\n", use_projection ? "projection table" : "matvec");
+            continue;
+        } else if (strcmp(input, "freeze") == 0 || strncmp(input, "freeze ", 7) == 0) {
+            const char* arg = input + 6;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "on") == 0) {
+                freeze_embeddings = 1;
+            } else if (strcmp(arg, "off") == 0) {
+                freeze_embeddings = 0;
+            } else if (*arg != '\0') {
+                printf("Usage: freeze [on | off]\n");
+            }
+            printf("Embeddings: %s\n", freeze_embeddings
+                   ? "frozen (layer 0 trains from the projection table)" : "trainable");
+            continue;
+        } else if (strcmp(input, "profile") == 0 || strncmp(input, "profile ", 8) == 0) {
+            const char* arg = input + 7;
+            while (*arg == ' ') arg++;
+            if (strcmp(arg, "reset") == 0) {
+                prof_reset();
+                printf("Profile counters cleared\n");
+            } else if (strncmp(arg, "trace ", 6) == 0 && arg[6] != '\0') {
+                prof_trace_next_epoch(arg + 6);
+                printf("The next training epoch will be traced to %s\n", arg + 6);
+            } else if (*arg == '\0') {
+                prof_report();
+            } else {
+                printf("Usage: profile [reset | trace FILE]\n");
+            }
+            continue;
+        } else if (strcmp(input, "verify") == 0) {
+            verify_model();
+            continue;
         } else if (strcmp(input, "save") == 0) {
             save_model();
             continue;
@@ -79,7 +335,8 @@ void interactive_mode() {
             printf("\n");
             continue;
         } else if (strlen(input) == 0) continue;
-        else generate_text_from_seed(input, 32);
+        else generate_text_from_seed(session, input, 32);
         printf("\n");
     }
+    brook_session_free(session);
 }
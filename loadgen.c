@@ -0,0 +1,140 @@
+// Load generator for "brook serve":
+//   brook load [ADDRESS] [CLIENTS] [REQUESTS] [STEPS]
+// Opens CLIENTS connections, each sending REQUESTS requests back to back
+// (every fourth a score request, the rest generate STEPS words), then
+// prints client-side latency percentiles and throughput followed by the
+// server's own stats line.
+#include "brook.h"
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+static const char* load_prompts[] = {
+    "the", "the man", "water flows", "in the beginning", "she said", "light and", "all of the", "we"
+};
+#define LOAD_PROMPTS (int)(sizeof(load_prompts) / sizeof(load_prompts[0]))
+
+typedef struct {
+    const char* address;
+    int id;
+    int requests;
+    int steps;
+    double* latencies;              // per completed request, seconds
+    int completed;                  // requests answered "ok"
+    long words;                     // words returned by generate requests
+    int errors;
+} load_client;
+
+// Sends one request line and reads the reply into reply; 0 on a dropped connection
+static int load_request(FILE* in, FILE* out, const char* request, char* reply, int reply_size) {
+    if (fprintf(out, "%s\n", request) < 0 || fflush(out) != 0) return 0;
+    return fgets(reply, reply_size, in) != NULL;
+}
+
+static int count_words(const char* text) {
+    int words = 0, in_word = 0;
+    for (; *text; text++) {
+        if (*text == ' ') in_word = 0;
+        else if (!in_word) { in_word = 1; words++; }
+    }
+    return words;
+}
+
+static void* load_client_main(void* arg) {
+    load_client* c = arg;
+    int fd = serve_connect(c->address);
+    if (fd < 0) {
+        c->errors = c->requests;
+        return NULL;
+    }
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+    char request[256], reply[SERVE_LINE];
+    for (int i = 0; i < c->requests; i++) {
+        const char* prompt = load_prompts[(c->id + i) % LOAD_PROMPTS];
+        int score = (i % 4) == 3;
+        if (score) snprintf(request, sizeof(request), "score %s and the light flows through all", prompt);
+        else snprintf(request, sizeof(request), "generate %d %s", c->steps, prompt);
+        double start = now_seconds();
+        if (!load_request(in, out, request, reply, sizeof(reply))) {
+            c->errors += c->requests - i;
+            break;
+        }
+        double latency = now_seconds() - start;
+        if (strncmp(reply, "ok ", 3) != 0) {
+            c->errors++;
+            continue;
+        }
+        c->latencies[c->completed++] = latency;
+        if (!score) c->words += count_words(reply + 3);
+    }
+    load_request(in, out, "quit", reply, sizeof(reply));
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+/**
+ * Runs the load test against a running server. args: [ADDRESS]
+ * [CLIENTS] [REQUESTS] [STEPS]. Returns 0 if every request succeeded.
+ */
+int load_main(int argc, char* argv[]) {
+    const char* address = argc > 0 ? argv[0] : SERVE_DEFAULT_ADDRESS;
+    int clients = argc > 1 ? atoi(argv[1]) : LOAD_DEFAULT_CLIENTS;
+    int requests = argc > 2 ? atoi(argv[2]) : LOAD_DEFAULT_REQUESTS;
+    int steps = argc > 3 ? atoi(argv[3]) : LOAD_DEFAULT_STEPS;
+    if (clients < 1 || clients > MAX_THREADS || requests < 1 || steps < 1 || steps > SERVE_MAX_STEPS) {
+        printf("Usage: brook load [ADDRESS] [CLIENTS 1-%d] [REQUESTS] [STEPS 1-%d]\n", MAX_THREADS, SERVE_MAX_STEPS);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    load_client* c = calloc(clients, sizeof(load_client));
+    pthread_t* threads = malloc(clients * sizeof(pthread_t));
+    double* latencies = calloc((size_t)clients * requests, sizeof(double));
+    if (!c || !threads || !latencies) {
+        printf("Error: Could not allocate load clients\n");
+        exit(1);
+    }
+    double start = now_seconds();
+    for (int i = 0; i < clients; i++) {
+        c[i].address = address;
+        c[i].id = i;
+        c[i].requests = requests;
+        c[i].steps = steps;
+        c[i].latencies = &latencies[(size_t)i * requests];
+        pthread_create(&threads[i], NULL, load_client_main, &c[i]);
+    }
+    long words = 0;
+    int errors = 0, completed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        words += c[i].words;
+        errors += c[i].errors;
+        // Packed in place: failed requests have no latency to count
+        memmove(&latencies[completed], c[i].latencies, c[i].completed * sizeof(double));
+        completed += c[i].completed;
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%d clients x %d requests (%d words per generate) in %.2fs, %d errors\n",
+           clients, requests, steps, elapsed, errors);
+    printf("  latency over %d completed requests: p50 %.2fms, p99 %.2fms\n", completed,
+           1e3 * percentile(latencies, completed, 0.50), 1e3 * percentile(latencies, completed, 0.99));
+    printf("  %.0f requests/s, %.0f generated words/s\n", completed / elapsed, words / elapsed);
+
+    int fd = serve_connect(address);
+    if (fd >= 0) {
+        FILE* in = fdopen(fd, "r");
+        FILE* out = fdopen(dup(fd), "w");
+        char reply[SERVE_LINE];
+        if (load_request(in, out, "stats", reply, sizeof(reply))) printf("  server: %s", reply + 3);
+        load_request(in, out, "quit", reply, sizeof(reply));
+        fclose(in);
+        fclose(out);
+    }
+    free(c);
+    free(threads);
+    free(latencies);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,294 @@
+// Approximate maximum-inner-product search over the rows of W_output.
+// Rows are lifted to cols + 1 dimensions with the norm-augmented
+// transform w' = [w, sqrt(M^2 - |w|^2)] (M = largest row norm), so every
+// lifted row has norm M and, for a query q' = [q, 0],
+//     |q' - w'|^2 = |q|^2 + M^2 - 2 q.w:
+// the largest inner product is the nearest neighbour. The lifted rows are
+// clustered with k-means into mips_lists inverted lists, and the rows of
+// each list are copied contiguously so a probe streams them. predict
+// probes the mips_nprobe lists whose centroids point closest to the query
+// (cosine q'.c' / |c'|) and scores only their rows exactly. Ranking by L2
+// distance to the centroids instead lets the query-independent |c'|^2
+// term decide: the lists of rare, low-norm rows sit near the augmented
+// axis, and their large-norm centroids were always probed last.
+#include "brook.h"
+#include <float.h>
+
+int use_mips = 0;
+int mips_nprobe = 0;             // 0: MIPS_DEFAULT_PROBE_FRACTION of the lists
+
+static int mips_lists = 0;
+static int mips_rows = 0;        // vocab_size the index was built for
+static int mips_cols = 0;
+static int mips_ready = 0;
+static float* centroids = NULL;      // mips_lists x mips_cols
+static float* centroid_extra = NULL; // augmented coordinate of each centroid
+static float* centroid_bias = NULL;  // -|c'|^2 / 2, for k-means assignment
+static float* centroid_inv_norm = NULL;  // 1 / |c'|, for ranking lists by cosine
+static int* list_offset = NULL;      // mips_lists + 1 row offsets into list_ids
+static int* list_ids = NULL;         // vocabulary id of each stored row
+static float* list_rows = NULL;      // W_output rows in list order
+
+void free_mips() {
+    free(centroids);
+    free(centroid_extra);
+    free(centroid_bias);
+    free(centroid_inv_norm);
+    free(list_offset);
+    free(list_ids);
+    free(list_rows);
+    centroids = NULL;
+    centroid_extra = NULL;
+    centroid_bias = NULL;
+    centroid_inv_norm = NULL;
+    list_offset = NULL;
+    list_ids = NULL;
+    list_rows = NULL;
+    mips_lists = 0;
+    mips_rows = 0;
+    mips_ready = 0;
+}
+
+void invalidate_mips() {
+    mips_ready = 0;
+}
+
+int mips_current() {
+    return mips_ready && mips_rows == vocab_size && mips_cols == hidden_sizes[num_hidden_layers - 1];
+}
+
+// Nearest centroid of lifted row (w, extra) by -|c'|^2/2 + w'.c'
+static int nearest_list(const float* w, float extra, float* scores) {
+    fast_matmul(centroids, w, scores, mips_lists, mips_cols);
+    int best = 0;
+    float best_score = -FLT_MAX;
+    for (int c = 0; c < mips_lists; c++) {
+        float s = scores[c] + extra * centroid_extra[c] + centroid_bias[c];
+        if (s > best_score) { best_score = s; best = c; }
+    }
+    return best;
+}
+
+static void update_bias() {
+    for (int c = 0; c < mips_lists; c++) {
+        float n2 = simd->dot(&centroids[(size_t)c * mips_cols], &centroids[(size_t)c * mips_cols], mips_cols);
+        n2 += centroid_extra[c] * centroid_extra[c];
+        centroid_bias[c] = -0.5f * n2;
+        centroid_inv_norm[c] = (n2 > 0.0f) ? 1.0f / sqrtf(n2) : 0.0f;
+    }
+}
+
+/**
+ * Builds the index from the current W_output: k-means over the lifted
+ * rows (MIPS_KMEANS_ITERS rounds from evenly spaced rows), then one
+ * contiguous block of rows per list.
+ */
+void build_mips_index() {
+    free_mips();
+    int V = vocab_size, cols = hidden_sizes[num_hidden_layers - 1];
+    int lists = (int)(sqrtf((float)V) + 0.5f);
+    if (lists > MIPS_MAX_LISTS) lists = MIPS_MAX_LISTS;
+    if (lists < 1) lists = 1;
+    mips_lists = lists;
+    mips_cols = cols;
+    mips_rows = V;
+
+    centroids = malloc((size_t)lists * cols * sizeof(float));
+    centroid_extra = malloc(lists * sizeof(float));
+    centroid_bias = malloc(lists * sizeof(float));
+    centroid_inv_norm = malloc(lists * sizeof(float));
+    list_offset = malloc((lists + 1) * sizeof(int));
+    list_ids = malloc(V * sizeof(int));
+    list_rows = malloc((size_t)V * cols * sizeof(float));
+    float* extra = malloc(V * sizeof(float));
+    int* assign = malloc(V * sizeof(int));
+    float* scores = malloc(lists * sizeof(float));
+    float* sums = malloc((size_t)lists * (cols + 1) * sizeof(float));
+    int* counts = malloc(lists * sizeof(int));
+    if (!centroids || !centroid_extra || !centroid_bias || !centroid_inv_norm || !list_offset || !list_ids ||
+        !list_rows || !extra || !assign || !scores || !sums || !counts) {
+        printf("Error: Could not allocate the MIPS index\n");
+        exit(1);
+    }
+
+    // Norm augmentation
+    float max_norm2 = 0.0f;
+    for (int i = 0; i < V; i++) {
+        const float* w = &W_output[(size_t)i * cols];
+        extra[i] = simd->dot(w, w, cols);
+        if (extra[i] > max_norm2) max_norm2 = extra[i];
+    }
+    for (int i = 0; i < V; i++) {
+        float e = max_norm2 - extra[i];
+        extra[i] = (e > 0.0f) ? sqrtf(e) : 0.0f;
+    }
+
+    for (int c = 0; c < lists; c++) {
+        int row = (int)((long long)c * V / lists);
+        memcpy(&centroids[(size_t)c * cols], &W_output[(size_t)row * cols], cols * sizeof(float));
+        centroid_extra[c] = extra[row];
+    }
+    for (int iter = 0; iter < MIPS_KMEANS_ITERS; iter++) {
+        update_bias();
+        memset(sums, 0, (size_t)lists * (cols + 1) * sizeof(float));
+        memset(counts, 0, lists * sizeof(int));
+        for (int i = 0; i < V; i++) {
+            const float* w = &W_output[(size_t)i * cols];
+            int c = nearest_list(w, extra[i], scores);
+            assign[i] = c;
+            simd->axpy(1.0f, w, &sums[(size_t)c * (cols + 1)], cols);
+            sums[(size_t)c * (cols + 1) + cols] += extra[i];
+            counts[c]++;
+        }
+        for (int c = 0; c < lists; c++) {
+            if (counts[c] == 0) continue;  // keep an empty list's centroid
+            float inv = 1.0f / counts[c];
+            for (int j = 0; j < cols; j++) centroids[(size_t)c * cols + j] = sums[(size_t)c * (cols + 1) + j] * inv;
+            centroid_extra[c] = sums[(size_t)c * (cols + 1) + cols] * inv;
+        }
+    }
+    update_bias();
+    for (int i = 0; i < V; i++) assign[i] = nearest_list(&W_output[(size_t)i * cols], extra[i], scores);
+
+    // Counting sort of the rows by list
+    memset(list_offset, 0, (lists + 1) * sizeof(int));
+    for (int i = 0; i < V; i++) list_offset[assign[i] + 1]++;
+    for (int c = 0; c < lists; c++) list_offset[c + 1] += list_offset[c];
+    memcpy(counts, list_offset, lists * sizeof(int));
+    for (int i = 0; i < V; i++) {
+        int pos = counts[assign[i]]++;
+        list_ids[pos] = i;
+        memcpy(&list_rows[(size_t)pos * cols], &W_output[(size_t)i * cols], cols * sizeof(float));
+    }
+
+    free(extra);
+    free(assign);
+    free(scores);
+    free(sums);
+    free(counts);
+    mips_ready = 1;
+}
+
+// Lists probed per query
+int mips_probe_count() {
+    int n = mips_nprobe;
+    if (n <= 0) n = (int)(mips_lists * MIPS_DEFAULT_PROBE_FRACTION + 0.5f);
+    if (n < 1) n = 1;
+    if (n > mips_lists) n = mips_lists;
+    return n;
+}
+
+/**
+ * Picks the nprobe lists whose centroids have the highest cosine to query
+ * h (mips_current must hold; |h| does not change the order). Writes their
+ * ids to lists and returns how many.
+ */
+int mips_probe(const float* h, int nprobe, int* lists) {
+    float scores[MIPS_MAX_LISTS];
+    fast_matmul(centroids, h, scores, mips_lists, mips_cols);
+    int n = 0;
+    for (int c = 0; c < mips_lists; c++) {
+        float s = scores[c] * centroid_inv_norm[c];
+        scores[c] = s;
+        // insertion into the best-nprobe list, best first
+        int pos = (n < nprobe) ? n++ : nprobe;
+        while (pos > 0 && scores[lists[pos - 1]] < s) {
+            if (pos < nprobe) lists[pos] = lists[pos - 1];
+            pos--;
+        }
+        if (pos < nprobe) lists[pos] = c;
+    }
+    return n;
+}
+
+// Rows of one list: returns the count and points rows/ids at its block
+int mips_list(int list, const float** rows, const int** ids) {
+    int start = list_offset[list];
+    *rows = &list_rows[(size_t)start * mips_cols];
+    *ids = &list_ids[start];
+    return list_offset[list + 1] - start;
+}
+
+// Probed top-k of every sample at nprobe lists: recall@1 and recall@k
+// against the exact top-k, and seconds per query
+static void probe_recall(const float* h, const int* exact, int samples, int k, int nprobe,
+                         double* recall1, double* recallk, double* seconds) {
+    int idx[MAX_TOP_K];
+    float val[MAX_TOP_K];
+    int saved = mips_nprobe;
+    mips_nprobe = nprobe;
+    long hits1 = 0, hitsk = 0;
+    double start = now_seconds();
+    for (int i = 0; i < samples; i++) {
+        int n = output_top_k(&h[(size_t)i * mips_cols], k, 1, idx, val);
+        const int* ref = &exact[(size_t)i * k];
+        if (n > 0 && idx[0] == ref[0]) hits1++;
+        for (int a = 0; a < n; a++)
+            for (int b = 0; b < k; b++)
+                if (idx[a] == ref[b]) hitsk++;
+    }
+    *seconds = (now_seconds() - start) / samples;
+    *recall1 = (double)hits1 / samples;
+    *recallk = (double)hitsk / ((double)samples * k);
+    mips_nprobe = saved;
+}
+
+/**
+ * Recall@k of the probed top-k against the exact top-k, and time per
+ * query, over the first MIPS_EVAL_SAMPLES training windows for several
+ * probe counts. Warns if recall at the default probe count is not well
+ * above the fraction of lists probed, i.e. what probing at random gives.
+ */
+void mips_report() {
+    if (tree_in_use()) {
+        printf("The MIPS index covers W_output, which the tree softmax does not use; "
+               "switch to softmax full to evaluate it\n");
+        return;
+    }
+    if (!mips_current()) build_mips_index();
+    int ctx = context_window > MAX_CONTEXT ? MAX_CONTEXT : context_window;
+    int samples = token_count - ctx;
+    if (samples > MIPS_EVAL_SAMPLES) samples = MIPS_EVAL_SAMPLES;
+    if (samples <= 0) {
+        printf("No training tokens to evaluate the MIPS index on\n");
+        return;
+    }
+    const int k = 10;
+    int cols = mips_cols;
+    float* h = malloc((size_t)samples * cols * sizeof(float));
+    int* exact = malloc((size_t)samples * k * sizeof(int));
+    float val[MAX_TOP_K];
+    brook_session* session = brook_session_create(1);
+    for (int i = 0; i < samples; i++) {
+        memcpy(&h[(size_t)i * cols], context_hidden(session, &tokens[i], ctx), cols * sizeof(float));
+    }
+    brook_session_free(session);
+    double t0 = now_seconds();
+    for (int i = 0; i < samples; i++) output_top_k(&h[(size_t)i * cols], k, 0, &exact[(size_t)i * k], val);
+    double exact_time = (now_seconds() - t0) / samples;
+
+    printf("MIPS index: %d rows in %d lists, recall against the exact top-%d over %d samples:\n",
+           mips_rows, mips_lists, k, samples);
+    printf("  exact: %.1fus per query\n", 1e6 * exact_time);
+    double recall1, recallk, per;
+    for (int nprobe = 1; ; nprobe = (nprobe * 2 < mips_lists) ? nprobe * 2 : mips_lists) {
+        probe_recall(h, exact, samples, k, nprobe, &recall1, &recallk, &per);
+        printf("  nprobe %3d: recall@1 %.1f%%, recall@%d %.1f%%, %.1fus per query (%.1fx)\n",
+               nprobe, 100.0 * recall1, k, 100.0 * recallk, 1e6 * per, exact_time / per);
+        if (nprobe == mips_lists) break;
+    }
+
+    int probes = mips_probe_count();
+    double fraction = (double)probes / mips_lists;
+    probe_recall(h, exact, samples, k, probes, &recall1, &recallk, &per);
+    printf("  probing %d lists (%.0f%%) by default (mips on N to change): recall@%d %.1f%%\n",
+           probes, 100.0 * fraction, k, 100.0 * recallk);
+    // Random lists would find about fraction of the top-k; demand at least
+    // half of the way from there to perfect recall
+    if (recallk < fraction + 0.5 * (1.0 - fraction)) {
+        printf("  Warning: recall@%d is not well above the %.0f%% that probing lists at random gives;\n"
+               "  the index does not fit this model (use more probes or mips off)\n", k, 100.0 * fraction);
+    }
+    free(h);
+    free(exact);
+}
@@ -1,34 +1,111 @@
 #include "brook.h"
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-void allocate_weights() {
+#define MODEL_MAGIC 0x4B4F5242   // "BROK"
+#define MODEL_VERSION 3
+#define LEGACY_VOCAB_ROWS 5100   // unversioned files store MAX_VOCAB (5100) rows
+#define TENSOR_ALIGN 64          // v3 tensor data offsets are multiples of this
+
+int vocab_capacity = 0;          // rows allocated in embed and W_output
+
+// Version 3 container. A fixed header, then a tensor table, then each
+// tensor's raw data at a TENSOR_ALIGN-aligned offset. Tensors are stored
+// exactly as they are laid out in memory, so W[], W_output and embed can
+// point straight into a read-only mapping of the file.
+typedef struct {
+    int32_t magic;
+    int32_t version;
+    int32_t vocab_size;
+    int32_t num_hidden_layers;
+    int32_t hidden_sizes[MAX_HIDDEN_LAYERS];
+    int32_t embed_dim;
+    int32_t max_context;
+    int32_t word_len;            // bytes per vocabulary entry
+    int32_t num_tensors;
+    uint32_t checksum;           // FNV-1a over every byte after the header
+    uint64_t file_size;
+} model_header;
+
+typedef struct {
+    char name[16];
+    uint64_t offset;
+    uint64_t size;               // bytes
+} tensor_entry;
+
+// Where training left off, so a run resumes from a checkpoint with the
+// same epoch count and learning-rate schedule. Files written before it
+// was added have no train_state tensor and resume from epoch 0.
+typedef struct {
+    int32_t epochs_trained;
+    float initial_lr;
+    float current_lr;
+    uint32_t checkpoint_id;      // shared with tree.bin and optim.bin; 0 in older files
+} train_state;
+
+// vocab, embed, pos_embed, W0.., W_output, train_state
+#define MAX_MODEL_TENSORS (MAX_HIDDEN_LAYERS + 5)
+
+// The read-only mapping backing W[], W_output and embed, if any
+static unsigned char* model_map = NULL;
+static size_t model_map_size = 0;
+
+static void allocate_layer_buffers() {
     for (int layer = 0; layer < num_hidden_layers; layer++) {
-        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
         int output_size = hidden_sizes[layer];
-        W[layer] = (float*)malloc(input_size * output_size * sizeof(float));
-        if (!W[layer]) {
-            printf("Error: Could not allocate memory for layer %d weights\n", layer);
-            exit(1);
-        }
-        activation_buffers[layer] = (float*)malloc(output_size * sizeof(float));
+        activation_buffers[layer] = alloc_aligned(output_size * sizeof(float));
         if (!activation_buffers[layer]) {
             printf("Error: Could not allocate memory for layer %d activations\n", layer);
             exit(1);
         }
-        gradient_buffers[layer] = (float*)malloc(output_size * sizeof(float));
+        gradient_buffers[layer] = alloc_aligned(output_size * sizeof(float));
         if (!gradient_buffers[layer]) {
             printf("Error: Could not allocate memory for layer %d gradients\n", layer);
             exit(1);
         }
     }
+}
+
+void allocate_weights() {
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+        int output_size = hidden_sizes[layer];
+        W[layer] = alloc_aligned((size_t)input_size * output_size * sizeof(float));
+        if (!W[layer]) {
+            printf("Error: Could not allocate memory for layer %d weights\n", layer);
+            exit(1);
+        }
+    }
+    allocate_layer_buffers();
+    if (vocab_capacity < MIN_VOCAB_ROWS) vocab_capacity = MIN_VOCAB_ROWS;
     int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    W_output = (float*)malloc(OUTPUT_SIZE * final_input_size * sizeof(float));
+    W_output = alloc_aligned((size_t)vocab_capacity * final_input_size * sizeof(float));
     if (!W_output) {
         printf("Error: Could not allocate memory for output weights\n");
         exit(1);
     }
+    embed = alloc_aligned((size_t)vocab_capacity * sizeof(*embed));
+    if (!embed) {
+        printf("Error: Could not allocate memory for embeddings\n");
+        exit(1);
+    }
 }
 
 void free_weights() {
+    invalidate_projection();
+    invalidate_mips();
+    if (model_map) {
+        // Mapped tensors are released with the mapping, not freed
+        munmap(model_map, model_map_size);
+        model_map = NULL;
+        model_map_size = 0;
+        for (int layer = 0; layer < num_hidden_layers; layer++) W[layer] = NULL;
+        W_output = NULL;
+        embed = NULL;
+    }
     for (int layer = 0; layer < num_hidden_layers; layer++) {
         if (W[layer]) {
 			free(W[layer]); W[layer] = NULL; 
@@ -43,23 +120,119 @@ void free_weights() {
 		}
     }
     if (W_output) { free(W_output); W_output = NULL; }
+    if (embed) { free(embed); embed = NULL; }
 }
 
-void initialize_weights() {
-    allocate_weights();
-    
+// Weight initialization stream, started from the training seed on first use
+static uint64_t init_rng = 0;
+
+/** Uniform float in [0, 1) for weight initialization. */
+float init_random() {
+    if (!init_rng) init_rng = rng_seed(training_seed() ^ 0x696E6974ULL);
+    return rng_float(&init_rng);
+}
+
+// Random init for embedding and output rows [from, to)
+static void init_vocab_rows(int from, int to) {
     // Initialize word embeddings with Xavier initialization
     float xavier_embed = sqrtf(2.0f / (MAX_EMBED + vocab_size));
-    for (int i = 0; i < MAX_VOCAB; i++) {
+    for (int i = from; i < to; i++) {
         for (int j = 0; j < MAX_EMBED; j++) {
-            embed[i][j] = ((float)rand() / RAND_MAX - 0.5f) * xavier_embed;
+            embed[i][j] = (init_random() - 0.5f) * xavier_embed;
+        }
+    }
+
+    // Initialize output layer weights with Xavier initialization
+    int final_input_size = hidden_sizes[num_hidden_layers - 1];
+    float xavier_output = sqrtf(2.0f / (final_input_size + vocab_capacity));
+    for (int i = from; i < to; i++) {
+        for (int j = 0; j < final_input_size; j++) {
+            W_OUTPUT_ACCESS(i, j) = (init_random() - 0.5f) * xavier_output;
+        }
+    }
+}
+
+/**
+ * Copies mapped weights into private heap buffers and drops the mapping.
+ * Anything that writes W[], W_output or embed (training, vocabulary
+ * growth) calls this first; it is a no-op for heap-allocated weights.
+ */
+void make_weights_writable() {
+    if (!model_map) return;
+    float* copies[MAX_HIDDEN_LAYERS];
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        size_t bytes = (size_t)hidden_sizes[layer] * ((layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1]) * sizeof(float);
+        copies[layer] = alloc_aligned(bytes);
+        if (!copies[layer]) {
+            printf("Error: Could not allocate memory for layer %d weights\n", layer);
+            exit(1);
         }
+        memcpy(copies[layer], W[layer], bytes);
     }
+    size_t out_bytes = (size_t)vocab_capacity * hidden_sizes[num_hidden_layers - 1] * sizeof(float);
+    float* out_copy = alloc_aligned(out_bytes);
+    float (*embed_copy)[MAX_EMBED] = alloc_aligned((size_t)vocab_capacity * sizeof(*embed));
+    if (!out_copy || !embed_copy) {
+        printf("Error: Could not allocate memory for vocabulary weights\n");
+        exit(1);
+    }
+    memcpy(out_copy, W_output, out_bytes);
+    memcpy(embed_copy, embed, (size_t)vocab_capacity * sizeof(*embed));
+    munmap(model_map, model_map_size);
+    model_map = NULL;
+    model_map_size = 0;
+    for (int layer = 0; layer < num_hidden_layers; layer++) W[layer] = copies[layer];
+    W_output = out_copy;
+    embed = embed_copy;
+}
+
+/**
+ * Resizes embed and W_output to exactly rows rows. Existing rows keep
+ * their values; new rows get a fresh random init.
+ */
+void resize_vocab_rows(int rows) {
+    if (rows < MIN_VOCAB_ROWS) rows = MIN_VOCAB_ROWS;
+    if (rows == vocab_capacity) return;
+    make_weights_writable();
+    int final_input_size = hidden_sizes[num_hidden_layers - 1];
+    size_t row_bytes = (size_t)final_input_size * sizeof(float);
+    float* grown_output = realloc_aligned(W_output, vocab_capacity * row_bytes, rows * row_bytes);
+    float (*grown_embed)[MAX_EMBED] = realloc_aligned(embed, vocab_capacity * sizeof(*embed), rows * sizeof(*embed));
+    if (!grown_output || !grown_embed) {
+        printf("Error: Could not resize vocabulary weights to %d rows\n", rows);
+        exit(1);
+    }
+    W_output = grown_output;
+    embed = grown_embed;
+    int old_rows = vocab_capacity;
+    vocab_capacity = rows;
+    invalidate_projection();
+    invalidate_mips();
+    if (rows > old_rows) init_vocab_rows(old_rows, rows);
+}
+
+/**
+ * Makes room for at least rows vocabulary rows, growing geometrically
+ * so a stream of new words costs amortized O(1) reallocations.
+ */
+void ensure_vocab_capacity(int rows) {
+    if (rows <= vocab_capacity) return;
+    int new_rows = vocab_capacity * 2;
+    if (new_rows < rows) new_rows = rows;
+    if (new_rows > MAX_VOCAB) new_rows = MAX_VOCAB;
+    resize_vocab_rows(new_rows);
+}
+
+void initialize_weights() {
+    invalidate_projection();
+    invalidate_mips();
+    allocate_weights();
+    init_vocab_rows(0, vocab_capacity);
     
     // Initialize position embeddings with small random values
     for (int i = 0; i < MAX_CONTEXT; i++) {
         for (int j = 0; j < MAX_EMBED; j++) {
-            pos_embed[i][j] = ((float)rand() / RAND_MAX - 0.5f) * 0.01f;
+            pos_embed[i][j] = (init_random() - 0.5f) * 0.01f;
         }
     }
     
@@ -70,76 +243,307 @@ void initialize_weights() {
         float he_scale = sqrtf(2.0f / input_size);  // He initialization for ReLU
         for (int i = 0; i < output_size; i++) {
             for (int j = 0; j < input_size; j++) {
-                W_ACCESS(layer, i, j) = ((float)rand() / RAND_MAX - 0.5f) * he_scale;
+                W_ACCESS(layer, i, j) = (init_random() - 0.5f) * he_scale;
             }
         }
     }
-    
-    // Initialize output layer weights with Xavier initialization
-    int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    float xavier_output = sqrtf(2.0f / (final_input_size + OUTPUT_SIZE));
-    for (int i = 0; i < OUTPUT_SIZE; i++) {
-        for (int j = 0; j < final_input_size; j++) {
-            W_OUTPUT_ACCESS(i, j) = ((float)rand() / RAND_MAX - 0.5f) * xavier_output;
-        }
-    }
 }
 
-void relu_and_dropout_combined(float* v, int size, float dropout_rate, int training) {
-    if (training) {
-        float inv_keep_prob = 1.0f / (1.0f - dropout_rate);
-        for (int i = 0; i < size; i++) {
-            // Apply ReLU activation
-            if (v[i] < 0) v[i] = 0;
-            
-            // Apply dropout with inverse scaling
-            if ((float)rand() / RAND_MAX < dropout_rate) {
-                v[i] = 0;
-            } else {
-                v[i] *= inv_keep_prob;
-            }
+/**
+ * ReLU, then inverted dropout when rng (the caller's PRNG) is given; NULL
+ * is inference. ReLU and the keep scaling are one branch-free pass. At
+ * low rates the mask is drawn as geometric gaps between dropped units,
+ * so DROPOUT_RATE costs one draw per ~10k activations instead of one per
+ * activation; from DROPOUT_SPARSE_RATE up each 64-bit draw decides two
+ * units by integer threshold.
+ */
+void relu_and_dropout_combined(float* v, int size, float dropout_rate, uint64_t* rng) {
+    int dropout = rng && dropout_rate > 0.0f;
+    float scale = dropout ? 1.0f / (1.0f - dropout_rate) : 1.0f;
+    for (int i = 0; i < size; i++) v[i] = v[i] > 0.0f ? v[i] * scale : 0.0f;
+    if (!dropout) return;
+
+    if (dropout_rate < DROPOUT_SPARSE_RATE) {
+        // Units kept before the next drop ~ Geometric(rate)
+        float log_keep = log1pf(-dropout_rate);
+        long i = -1;
+        for (;;) {
+            float u = 1.0f - rng_float(rng);    // (0, 1]
+            i += 1 + (long)(logf(u) / log_keep);
+            if (i >= size) break;
+            v[i] = 0.0f;
         }
     } else {
-        // Inference mode: only apply ReLU, no dropout
-        for (int i = 0; i < size; i++) {
-            if (v[i] < 0) v[i] = 0;
+        uint32_t threshold = (uint32_t)(dropout_rate * 4294967296.0);
+        int i = 0;
+        for (; i + 1 < size; i += 2) {
+            uint64_t r = rng_next(rng);
+            v[i] = (uint32_t)r < threshold ? 0.0f : v[i];
+            v[i + 1] = (uint32_t)(r >> 32) < threshold ? 0.0f : v[i + 1];
         }
+        if (i < size && (uint32_t)rng_next(rng) < threshold) v[i] = 0.0f;
     }
 }
 
-void save_vocab() {
-    FILE* f = fopen("vocab.txt", "w");
-    if (!f) {
-        printf("Error: Could not save vocab.txt\n");
-        return;
-    }
+void write_vocab(FILE* f) {
     for (int i = 0; i < vocab_size; i++) {
         fprintf(f, "%s\n", vocab[i]);
     }
-    fclose(f);
 }
 
-void save_model() {
-    FILE* f = fopen("weights.bin", "wb");
-    if (!f) {
-        printf("Error: Could not save weights.bin\n");
-        return;
-    }
-    fwrite(&vocab_size, sizeof(int), 1, f);
-    fwrite(&num_hidden_layers, sizeof(int), 1, f);
-    fwrite(hidden_sizes, sizeof(int), num_hidden_layers, f);
-    fwrite(embed, sizeof(embed), 1, f);
-    fwrite(pos_embed, sizeof(pos_embed), 1, f);
+static uint32_t fnv1a(uint32_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// The tensors of the current model in file order. Only live vocabulary
+// rows are stored.
+static int model_tensors(tensor_entry* table, const void** data, const train_state* state) {
+    int n = 0;
+    int final_input_size = hidden_sizes[num_hidden_layers - 1];
+    strcpy(table[n].name, "vocab");
+    table[n].size = (uint64_t)vocab_size * MAX_VOCAB_WORD_LEN;
+    data[n++] = vocab;
+    strcpy(table[n].name, "embed");
+    table[n].size = (uint64_t)vocab_size * sizeof(*embed);
+    data[n++] = embed;
+    strcpy(table[n].name, "pos_embed");
+    table[n].size = sizeof(pos_embed);
+    data[n++] = pos_embed;
     for (int layer = 0; layer < num_hidden_layers; layer++) {
         int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
-        int output_size = hidden_sizes[layer];
-        fwrite(W[layer], sizeof(float), input_size * output_size, f);
+        snprintf(table[n].name, sizeof(table[n].name), "W%d", layer);
+        table[n].size = (uint64_t)input_size * hidden_sizes[layer] * sizeof(float);
+        data[n++] = W[layer];
+    }
+    strcpy(table[n].name, "W_output");
+    table[n].size = (uint64_t)vocab_size * final_input_size * sizeof(float);
+    data[n++] = W_output;
+    strcpy(table[n].name, "train_state");
+    table[n].size = sizeof(*state);
+    data[n++] = state;
+    return n;
+}
+
+/**
+ * Writes the model as a v3 container. The checksum is computed in a
+ * first pass so the file is written strictly front to back, which lets
+ * checkpoints serialize into a memory stream.
+ */
+void write_model(FILE* f) {
+    tensor_entry table[MAX_MODEL_TENSORS];
+    const void* data[MAX_MODEL_TENSORS];
+    train_state state;
+    memset(table, 0, sizeof(table));
+    memset(&state, 0, sizeof(state));
+    state.epochs_trained = epochs_trained;
+    state.initial_lr = initial_lr;
+    state.current_lr = current_lr;
+    state.checkpoint_id = checkpoint_id;
+    int num_tensors = model_tensors(table, data, &state);
+
+    uint64_t offset = sizeof(model_header) + num_tensors * sizeof(tensor_entry);
+    for (int t = 0; t < num_tensors; t++) {
+        offset = (offset + TENSOR_ALIGN - 1) / TENSOR_ALIGN * TENSOR_ALIGN;
+        table[t].offset = offset;
+        offset += table[t].size;
+    }
+
+    static const unsigned char zeros[TENSOR_ALIGN];
+    uint32_t checksum = fnv1a(2166136261u, table, num_tensors * sizeof(tensor_entry));
+    uint64_t pos = sizeof(model_header) + num_tensors * sizeof(tensor_entry);
+    for (int t = 0; t < num_tensors; t++) {
+        checksum = fnv1a(checksum, zeros, (size_t)(table[t].offset - pos));
+        checksum = fnv1a(checksum, data[t], table[t].size);
+        pos = table[t].offset + table[t].size;
+    }
+
+    model_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MODEL_MAGIC;
+    header.version = MODEL_VERSION;
+    header.vocab_size = vocab_size;
+    header.num_hidden_layers = num_hidden_layers;
+    memcpy(header.hidden_sizes, hidden_sizes, num_hidden_layers * sizeof(int));
+    header.embed_dim = MAX_EMBED;
+    header.max_context = MAX_CONTEXT;
+    header.word_len = MAX_VOCAB_WORD_LEN;
+    header.num_tensors = num_tensors;
+    header.checksum = checksum;
+    header.file_size = offset;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(table, sizeof(tensor_entry), num_tensors, f);
+    pos = sizeof(header) + num_tensors * sizeof(tensor_entry);
+    for (int t = 0; t < num_tensors; t++) {
+        fwrite(zeros, 1, (size_t)(table[t].offset - pos), f);
+        fwrite(data[t], 1, table[t].size, f);
+        pos = table[t].offset + table[t].size;
+    }
+}
+
+void save_model() {
+    if (save_checkpoint()) printf("Model saved.\n");
+}
+
+static const tensor_entry* find_tensor(const tensor_entry* table, int n, const char* name) {
+    for (int t = 0; t < n; t++) {
+        if (strncmp(table[t].name, name, sizeof(table[t].name)) == 0) return &table[t];
+    }
+    return NULL;
+}
+
+/**
+ * Checks that a v3 file's tensor table has every tensor the header's
+ * shapes call for, each aligned, in bounds and of the expected size.
+ */
+static int validate_tensors(const model_header* h, const tensor_entry* table) {
+    const char* names[MAX_MODEL_TENSORS];
+    uint64_t sizes[MAX_MODEL_TENSORS];
+    char layer_names[MAX_HIDDEN_LAYERS][16];
+    int n = 0;
+    names[n] = "vocab"; sizes[n++] = (uint64_t)h->vocab_size * MAX_VOCAB_WORD_LEN;
+    names[n] = "embed"; sizes[n++] = (uint64_t)h->vocab_size * MAX_EMBED * sizeof(float);
+    names[n] = "pos_embed"; sizes[n++] = sizeof(pos_embed);
+    for (int layer = 0; layer < h->num_hidden_layers; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : h->hidden_sizes[layer - 1];
+        snprintf(layer_names[layer], sizeof(layer_names[layer]), "W%d", layer);
+        names[n] = layer_names[layer];
+        sizes[n++] = (uint64_t)input_size * h->hidden_sizes[layer] * sizeof(float);
+    }
+    names[n] = "W_output";
+    sizes[n++] = (uint64_t)h->vocab_size * h->hidden_sizes[h->num_hidden_layers - 1] * sizeof(float);
+    if (h->num_tensors > n) {
+        names[n] = "train_state";
+        sizes[n++] = sizeof(train_state);
+    }
+
+    for (int t = 0; t < n; t++) {
+        const tensor_entry* e = find_tensor(table, h->num_tensors, names[t]);
+        if (!e || e->size != sizes[t] || e->offset % TENSOR_ALIGN != 0 ||
+            e->offset > h->file_size || e->size > h->file_size - e->offset) {
+            printf("Error: weights.bin tensor %s is missing or malformed\n", names[t]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Maps a version 3 weights.bin read-only and points W[], W_output and
+ * embed into it. Pages load on first touch and are shared through the
+ * page cache by every process using the same file.
+ */
+static int load_mapped_model() {
+    int fd = open("weights.bin", O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(model_header)) {
+        printf("Error reading model configuration\n");
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Error: Could not map weights.bin\n");
+        return 0;
+    }
+    const model_header* h = (const model_header*)base;
+    int valid = h->file_size == size && h->embed_dim == MAX_EMBED &&
+                h->max_context == MAX_CONTEXT && h->word_len == MAX_VOCAB_WORD_LEN &&
+                h->vocab_size >= 1 && h->vocab_size <= MAX_VOCAB &&
+                h->num_hidden_layers >= 1 && h->num_hidden_layers <= MAX_HIDDEN_LAYERS &&
+                (h->num_tensors == h->num_hidden_layers + 4 ||
+                 h->num_tensors == h->num_hidden_layers + 5) &&
+                sizeof(model_header) + h->num_tensors * sizeof(tensor_entry) <= size;
+    for (int layer = 0; valid && layer < h->num_hidden_layers; layer++) {
+        if (h->hidden_sizes[layer] < 1) valid = 0;
+    }
+    if (!valid) {
+        printf("Error: weights.bin header does not match this build\n");
+        munmap(base, size);
+        return 0;
+    }
+    const tensor_entry* table = (const tensor_entry*)(base + sizeof(model_header));
+    if (!validate_tensors(h, table)) {
+        munmap(base, size);
+        return 0;
+    }
+
+    free_weights();
+    num_hidden_layers = h->num_hidden_layers;
+    memcpy(hidden_sizes, h->hidden_sizes, num_hidden_layers * sizeof(int));
+    allocate_layer_buffers();
+    model_map = base;
+    model_map_size = size;
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        char name[16];
+        snprintf(name, sizeof(name), "W%d", layer);
+        W[layer] = (float*)(base + find_tensor(table, h->num_tensors, name)->offset);
+    }
+    W_output = (float*)(base + find_tensor(table, h->num_tensors, "W_output")->offset);
+    embed = (float (*)[MAX_EMBED])(base + find_tensor(table, h->num_tensors, "embed")->offset);
+    vocab_capacity = h->vocab_size;
+    memcpy(pos_embed, base + find_tensor(table, h->num_tensors, "pos_embed")->offset, sizeof(pos_embed));
+
+    // The vocabulary is small and mutable, so it is copied out
+    vocab_size = h->vocab_size;
+    const char* words = (const char*)(base + find_tensor(table, h->num_tensors, "vocab")->offset);
+    for (int i = 0; i < vocab_size; i++) {
+        memcpy(vocab[i], words + (size_t)i * MAX_VOCAB_WORD_LEN, MAX_VOCAB_WORD_LEN);
+        vocab[i][MAX_VOCAB_WORD_LEN - 1] = '\0';
+    }
+    vocab_index_rebuild();
+
+    const tensor_entry* state_entry = find_tensor(table, h->num_tensors, "train_state");
+    if (state_entry) {
+        train_state state;
+        memcpy(&state, base + state_entry->offset, sizeof(state));
+        epochs_trained = state.epochs_trained;
+        initial_lr = state.initial_lr;
+        current_lr = state.current_lr;
+        checkpoint_id = state.checkpoint_id;
+    }
+    printf("Mapped weights.bin read-only (%.1f MB)\n", size / (1024.0 * 1024.0));
+    return 1;
+}
+
+/**
+ * Recomputes a v3 weights.bin checksum. Loading does not, so that
+ * startup stays a lazy mapping. Returns 1 if it matches.
+ */
+int verify_model() {
+    FILE* f = fopen("weights.bin", "rb");
+    if (!f) {
+        printf("No weights.bin to verify\n");
+        return 0;
+    }
+    model_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != MODEL_MAGIC ||
+        header.version != MODEL_VERSION) {
+        printf("weights.bin is not a version %d model file (no checksum)\n", MODEL_VERSION);
+        fclose(f);
+        return 0;
+    }
+    uint32_t checksum = 2166136261u;
+    uint64_t total = sizeof(header);
+    unsigned char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        checksum = fnv1a(checksum, buf, n);
+        total += n;
     }
-    int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    fwrite(W_output, sizeof(float), OUTPUT_SIZE * final_input_size, f);
     fclose(f);
-    save_vocab();
-    printf("Model saved.\n");
+    int ok = checksum == header.checksum && total == header.file_size;
+    printf("weights.bin: %s (%llu bytes, checksum %08x)\n", ok ? "OK" : "CORRUPT",
+           (unsigned long long)total, checksum);
+    return ok;
 }
 
 void load_vocab() {
@@ -158,30 +562,88 @@ void load_vocab() {
             }
         }
         fclose(f);
+        vocab_index_rebuild();
     }
 }
 
+// Shared tail of every load path, once the weights and vocab are in
+static int finish_load() {
+    // Drop legacy padding rows, or make room if vocab.txt has more words.
+    // A mapped file that already covers the vocabulary stays mapped: the
+    // MIN_VOCAB_ROWS floor alone is no reason to copy it to the heap.
+    if (!model_map || vocab_capacity < vocab_size) resize_vocab_rows(vocab_size);
+    load_tree();
+    load_optim();
+    load_quantized();
+
+    printf("Model loaded: %d layers, %d vocabulary\n", num_hidden_layers, vocab_size);
+    if (epochs_trained > 0) {
+        printf("Training resumes at epoch %d (learning rate %.6f)\n", epochs_trained, scheduled_lr(epochs_trained));
+    }
+    return 1;
+}
+
 int load_model() {
     FILE* f = fopen("weights.bin", "rb");
     if (!f) return 0;
-    int saved_vocab_size, saved_layers, saved_sizes[MAX_HIDDEN_LAYERS];
-    if (fread(&saved_vocab_size, sizeof(int), 1, f) != 1 ||
-        fread(&saved_layers, sizeof(int), 1, f) != 1 ||
-        fread(saved_sizes, sizeof(int), saved_layers, f) != (size_t)saved_layers) {
+    checkpoint_id = 0;           // versions 1 and 2 carry none
+    initial_lr = 0.0f;           // nor a learning rate
+    // Versioned files start with MODEL_MAGIC; older files start with the
+    // vocab size and always store LEGACY_VOCAB_ROWS rows. Version 3 is
+    // mapped, versions 1 and 2 are read into heap buffers.
+    int first, version = 1, saved_vocab_size, saved_layers, saved_sizes[MAX_HIDDEN_LAYERS];
+    if (fread(&first, sizeof(int), 1, f) != 1) {
         printf("Error reading model configuration\n");
         fclose(f);
         return 0;
     }
-    if (saved_layers > MAX_HIDDEN_LAYERS) {
+    if (first == MODEL_MAGIC) {
+        if (fread(&version, sizeof(int), 1, f) != 1 ||
+            fread(&saved_vocab_size, sizeof(int), 1, f) != 1) {
+            printf("Error reading model configuration\n");
+            fclose(f);
+            return 0;
+        }
+        if (version == MODEL_VERSION) {
+            fclose(f);
+            if (!load_mapped_model()) return 0;
+            return finish_load();
+        }
+        if (version != 2) {
+            printf("Error: Unsupported model version %d\n", version);
+            fclose(f);
+            return 0;
+        }
+    } else {
+        saved_vocab_size = first;
+    }
+    int saved_rows = (version == 1) ? LEGACY_VOCAB_ROWS : saved_vocab_size;
+    if (saved_rows < 0 || saved_rows > MAX_VOCAB) {
+        printf("Error: Saved model has %d vocabulary rows, but max supported is %d\n", saved_rows, MAX_VOCAB);
+        fclose(f);
+        return 0;
+    }
+    if (fread(&saved_layers, sizeof(int), 1, f) != 1) {
+        printf("Error reading model configuration\n");
+        fclose(f);
+        return 0;
+    }
+    if (saved_layers < 1 || saved_layers > MAX_HIDDEN_LAYERS) {
         printf("Error: Saved model has %d layers, but max supported is %d\n", saved_layers, MAX_HIDDEN_LAYERS);
         fclose(f);
         return 0;
     }
+    if (fread(saved_sizes, sizeof(int), saved_layers, f) != (size_t)saved_layers) {
+        printf("Error reading model configuration\n");
+        fclose(f);
+        return 0;
+    }
     free_weights();
     num_hidden_layers = saved_layers;
     memcpy(hidden_sizes, saved_sizes, saved_layers * sizeof(int));
+    vocab_capacity = saved_rows;
     allocate_weights();
-    if (fread(embed, sizeof(embed), 1, f) != 1 ||
+    if (fread(embed, sizeof(*embed), saved_rows, f) != (size_t)saved_rows ||
         fread(pos_embed, sizeof(pos_embed), 1, f) != 1) {
         printf("Error reading embeddings\n");
         fclose(f);
@@ -197,7 +659,8 @@ int load_model() {
         }
     }
     int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    if (fread(W_output, sizeof(float), OUTPUT_SIZE * final_input_size, f) != (size_t)(OUTPUT_SIZE * final_input_size)) {
+    size_t output_count = (size_t)saved_rows * final_input_size;
+    if (fread(W_output, sizeof(float), output_count, f) != output_count) {
         printf("Error reading output weights\n");
         fclose(f);
         return 0;
@@ -205,9 +668,7 @@ int load_model() {
     fclose(f);
 
     load_vocab();
-
-    printf("Model loaded: %d layers, %d vocabulary\n", num_hidden_layers, vocab_size);
-    return 1;
+    return finish_load();
 }
 
 long long count_parameters() {
@@ -228,7 +689,7 @@ long long count_parameters() {
     
     // Output layer weights: final_hidden_size * output_vocabulary_size
     int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    total_params += (long long)OUTPUT_SIZE * final_input_size;
+    total_params += (long long)vocab_size * final_input_size;
     
     return total_params;
 }
@@ -249,7 +710,8 @@ void print_model_info() {
     }
     printf("]\n");
     
-    printf("Output size: %d\n", OUTPUT_SIZE);
+    printf("Output size: %d\n", vocab_size);
+    printf("SIMD kernels: %s\n", simd->name);
     
     printf("\n=== Parameter Breakdown ===\n");
     printf("Word embeddings: %lld\n", (long long)vocab_size * MAX_EMBED);
@@ -262,7 +724,7 @@ void print_model_info() {
     }
     
     int final_input_size = hidden_sizes[num_hidden_layers - 1];
-    printf("Output layer weights: %lld\n", (long long)OUTPUT_SIZE * final_input_size);
+    printf("Output layer weights: %lld\n", (long long)vocab_size * final_input_size);
     
     printf("\nTotal parameters: %lld\n", total_params);
     
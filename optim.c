@@ -0,0 +1,194 @@
+// Adam/AdamW optimizer state.
+// Each parameter tensor (W[layer], W_output, embed, pos_embed, W_tree)
+// gets first and second moment buffers of the same shape. They live for
+// the whole session, grow with the vocabulary, and are saved to
+// optim.bin next to weights.bin so a resumed run keeps its moments.
+#include "brook.h"
+
+int optimizer_type = OPTIMIZER_SGD;
+float adam_lr = ADAM_LEARNING_RATE;
+float weight_decay = ADAMW_WEIGHT_DECAY;
+int adam_step = 0;               // updates applied so far, for bias correction
+
+static float* adam_m[ADAM_TENSORS];
+static float* adam_v[ADAM_TENSORS];
+static size_t adam_len[ADAM_TENSORS];
+static adam_params step_params;
+
+const char* optimizer_name() {
+    if (optimizer_type == OPTIMIZER_ADAM) return "adam";
+    if (optimizer_type == OPTIMIZER_ADAMW) return "adamw";
+    return "sgd";
+}
+
+// Number of parameters in a tensor for the current model
+static size_t tensor_len(int tensor) {
+    int last_size = hidden_sizes[num_hidden_layers - 1];
+    if (tensor == ADAM_OUTPUT) return (size_t)vocab_capacity * last_size;
+    if (tensor == ADAM_EMBED) return (size_t)vocab_capacity * MAX_EMBED;
+    if (tensor == ADAM_POS) return MAX_CONTEXT * MAX_EMBED;
+    if (tensor == ADAM_TREE) return tree_ready ? (size_t)(tree_vocab_size - 1) * tree_hidden_size : 0;
+    if (tensor >= num_hidden_layers) return 0;
+    return (size_t)hidden_sizes[tensor] * ((tensor == 0) ? MAX_EMBED : hidden_sizes[tensor - 1]);
+}
+
+/**
+ * Makes a tensor's moments match its current size. Vocabulary-indexed
+ * tensors keep their existing rows when the vocabulary grows; any other
+ * shape change (new tree, new architecture) starts from zero.
+ */
+static void ensure_moments(int tensor) {
+    size_t len = tensor_len(tensor);
+    if (adam_len[tensor] == len) return;
+    if (tensor == ADAM_OUTPUT || tensor == ADAM_EMBED) {
+        size_t keep = adam_len[tensor] < len ? adam_len[tensor] : len;
+        float* m = realloc_aligned(adam_m[tensor], keep * sizeof(float), len * sizeof(float));
+        float* v = realloc_aligned(adam_v[tensor], keep * sizeof(float), len * sizeof(float));
+        if (!m || !v) {
+            printf("Error: Could not allocate optimizer state\n");
+            exit(1);
+        }
+        memset(m + keep, 0, (len - keep) * sizeof(float));
+        memset(v + keep, 0, (len - keep) * sizeof(float));
+        adam_m[tensor] = m;
+        adam_v[tensor] = v;
+    } else {
+        free(adam_m[tensor]);
+        free(adam_v[tensor]);
+        adam_m[tensor] = calloc_aligned(len, sizeof(float));
+        adam_v[tensor] = calloc_aligned(len, sizeof(float));
+        if (len > 0 && (!adam_m[tensor] || !adam_v[tensor])) {
+            printf("Error: Could not allocate optimizer state\n");
+            exit(1);
+        }
+    }
+    adam_len[tensor] = len;
+}
+
+/**
+ * Starts one optimizer step: advances the step count and fixes the bias
+ * corrections and weight decay used by every adam_update() in this step.
+ */
+void adam_begin_step(float lr) {
+    adam_step++;
+    step_params.lr = lr;
+    step_params.beta1 = ADAM_BETA1;
+    step_params.beta2 = ADAM_BETA2;
+    step_params.eps = ADAM_EPSILON;
+    step_params.clip = 0.5f;
+    step_params.bias1 = 1.0f / (1.0f - powf(ADAM_BETA1, (float)adam_step));
+    step_params.bias2 = 1.0f / (1.0f - powf(ADAM_BETA2, (float)adam_step));
+    step_params.decay = (optimizer_type == OPTIMIZER_ADAMW) ? lr * weight_decay : 0.0f;
+}
+
+// Applies the fused Adam step to param[offset, offset + n) of a tensor
+void adam_update(int tensor, float* param, const float* grad, size_t offset, int n) {
+    ensure_moments(tensor);
+    simd->adam(param + offset, grad + offset, adam_m[tensor] + offset,
+               adam_v[tensor] + offset, n, &step_params);
+}
+
+void free_optim() {
+    for (int t = 0; t < ADAM_TENSORS; t++) {
+        free(adam_m[t]);
+        free(adam_v[t]);
+        adam_m[t] = adam_v[t] = NULL;
+        adam_len[t] = 0;
+    }
+    adam_step = 0;
+}
+
+// Saved extent of a tensor: vocabulary tensors store only live rows
+static size_t saved_len(int tensor) {
+    if (tensor == ADAM_OUTPUT) return (size_t)vocab_size * hidden_sizes[num_hidden_layers - 1];
+    if (tensor == ADAM_EMBED) return (size_t)vocab_size * MAX_EMBED;
+    return tensor_len(tensor);
+}
+
+static int saved_tensor(int tensor) {
+    return tensor < num_hidden_layers || tensor >= ADAM_OUTPUT;
+}
+
+void write_optim(FILE* f) {
+    int magic = OPTIM_MAGIC, version = 2;
+    int tree_len = (int)tensor_len(ADAM_TREE);
+    fwrite(&magic, sizeof(int), 1, f);
+    fwrite(&version, sizeof(int), 1, f);
+    fwrite(&checkpoint_id, sizeof(uint32_t), 1, f);
+    fwrite(&optimizer_type, sizeof(int), 1, f);
+    fwrite(&adam_step, sizeof(int), 1, f);
+    fwrite(&adam_lr, sizeof(float), 1, f);
+    fwrite(&weight_decay, sizeof(float), 1, f);
+    fwrite(&vocab_size, sizeof(int), 1, f);
+    fwrite(&num_hidden_layers, sizeof(int), 1, f);
+    fwrite(hidden_sizes, sizeof(int), num_hidden_layers, f);
+    fwrite(&tree_len, sizeof(int), 1, f);
+    for (int t = 0; t < ADAM_TENSORS; t++) {
+        if (!saved_tensor(t)) continue;
+        ensure_moments(t);
+        fwrite(adam_m[t], sizeof(float), saved_len(t), f);
+        fwrite(adam_v[t], sizeof(float), saved_len(t), f);
+    }
+}
+
+/**
+ * Loads optim.bin if present and it matches the loaded model (vocabulary,
+ * layers, tree and checkpoint id; version 1 files have id 0). Restores
+ * the optimizer choice with the moments. Returns 1 on success.
+ */
+int load_optim() {
+    free_optim();
+    FILE* f = fopen("optim.bin", "rb");
+    if (!f) return 0;
+    int magic, version, type, step, V, layers, sizes[MAX_HIDDEN_LAYERS], tree_len;
+    float lr, wd;
+    uint32_t id = 0;
+    if (fread(&magic, sizeof(int), 1, f) != 1 || magic != OPTIM_MAGIC ||
+        fread(&version, sizeof(int), 1, f) != 1 || version < 1 || version > 2 ||
+        (version == 2 && fread(&id, sizeof(uint32_t), 1, f) != 1) ||
+        fread(&type, sizeof(int), 1, f) != 1 ||
+        fread(&step, sizeof(int), 1, f) != 1 ||
+        fread(&lr, sizeof(float), 1, f) != 1 ||
+        fread(&wd, sizeof(float), 1, f) != 1 ||
+        fread(&V, sizeof(int), 1, f) != 1 ||
+        fread(&layers, sizeof(int), 1, f) != 1 ||
+        layers < 1 || layers > MAX_HIDDEN_LAYERS ||
+        fread(sizes, sizeof(int), layers, f) != (size_t)layers ||
+        fread(&tree_len, sizeof(int), 1, f) != 1) {
+        printf("Error reading optim.bin header\n");
+        fclose(f);
+        return 0;
+    }
+    if (V != vocab_size || layers != num_hidden_layers ||
+        memcmp(sizes, hidden_sizes, layers * sizeof(int)) != 0 ||
+        tree_len != (int)tensor_len(ADAM_TREE) ||
+        (type != OPTIMIZER_ADAM && type != OPTIMIZER_ADAMW)) {
+        printf("Ignoring optim.bin: it does not match the loaded model\n");
+        fclose(f);
+        return 0;
+    }
+    if (id != checkpoint_id) {
+        printf("Ignoring optim.bin: it was saved with a different checkpoint than weights.bin\n");
+        fclose(f);
+        return 0;
+    }
+    for (int t = 0; t < ADAM_TENSORS; t++) {
+        if (!saved_tensor(t)) continue;
+        ensure_moments(t);
+        size_t len = saved_len(t);
+        if (fread(adam_m[t], sizeof(float), len, f) != len ||
+            fread(adam_v[t], sizeof(float), len, f) != len) {
+            printf("Error reading optim.bin\n");
+            fclose(f);
+            free_optim();
+            return 0;
+        }
+    }
+    fclose(f);
+    optimizer_type = type;
+    adam_step = step;
+    adam_lr = lr;
+    weight_decay = wd;
+    printf("Loaded optim.bin: %s, step %d\n", optimizer_name(), adam_step);
+    return 1;
+}
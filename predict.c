@@ -1,8 +1,11 @@
-// Optimized predict with persistent buffers, top-k softmax, and safe numerics.
+// Optimized predict with per-session buffers, fused top-k/top-p sampling, and safe numerics.
 // Usage:
-//   predict_init();                // once after model/weights/vars are loaded
-//   int tok = predict(context, n); // many times
-//   predict_cleanup();             // once at shutdown
+//   brook_session* s = brook_session_create(0); // per thread, after the model is loaded
+//   int tok = predict(s, context, n);           // many times
+//   predict_batch(s, ctxs, lens, n, NULL, NULL, toks, NULL); // n contexts per call
+//   brook_session_free(s);
+// Sessions share the model weights read-only; each owns its scratch
+// buffers, sampling settings and PRNG, so threads can predict concurrently.
 
 #include "brook.h"
 #include <math.h>
@@ -11,76 +14,87 @@
 #include <stdlib.h>
 #include <time.h>
 #include <float.h>
+#include <pthread.h>
 
-static float *predict_x = NULL;               // MAX_EMBED
-static float **predict_h = NULL;              // per-layer activations
-static float *predict_logits = NULL;          // OUTPUT_SIZE
-static int *predict_top_idx = NULL;           // top_k indices
-static float *predict_top_val = NULL;         // top_k logits (pre-softmax exp values)
-static int predict_allocated = 0;
+// Sampling defaults for new sessions ("sampling K P T"): keep the top_k
+// logits, then the smallest prefix of them holding top_p of the mass
+int sample_top_k = DEFAULT_TOP_K;
+float sample_top_p = 1.0f;
+float sample_temperature = TEMPERATURE;
 
-void predict_init()
-{
-    if (predict_allocated) return;
-
-    // Allocate once and reuse
-    predict_x = malloc(MAX_EMBED * sizeof(float));
+// Lazily built shared caches (projection table, MIPS index)
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    predict_h = malloc(num_hidden_layers * sizeof(float *));
+/**
+ * Creates an inference session sized for the loaded model. Sessions own
+ * every buffer predict writes, so each thread can run its own session
+ * concurrently over the shared, read-only weights. seed 0 seeds the
+ * PRNG from the clock.
+ */
+brook_session* brook_session_create(uint64_t seed)
+{
+    static volatile uint64_t sessions_created = 0;
+    brook_session* s = calloc(1, sizeof(brook_session));
+    if (!s) {
+        printf("Error: Could not allocate an inference session\n");
+        exit(1);
+    }
+    int max_input = MAX_EMBED;
+    s->x = alloc_aligned(MAX_EMBED * sizeof(float));
     for (int i = 0; i < num_hidden_layers; ++i) {
-        predict_h[i] = malloc(hidden_sizes[i] * sizeof(float));
+        s->h[i] = alloc_aligned(hidden_sizes[i] * sizeof(float));
+        if (!s->h[i]) {
+            printf("Error: Could not allocate session activations\n");
+            exit(1);
+        }
+        if (hidden_sizes[i] > max_input) max_input = hidden_sizes[i];
     }
-
-    predict_logits = malloc(OUTPUT_SIZE * sizeof(float));
-
-    // top-k buffers sized to a safe upper bound (choose 32 if you want, but we pick 64)
-    // We'll allow dynamic top_k at runtime but allocate max possible = vocab_size (worst-case)
-    // For memory efficiency you may prefer a fixed upper bound like 256.
-    int max_topk = (vocab_size < 256) ? vocab_size : 256;
-    predict_top_idx = malloc(max_topk * sizeof(int));
-    predict_top_val = malloc(max_topk * sizeof(float));
-
-    // Seed RNG once. If you want reproducible output, call srand(...) yourself BEFORE predict_init.
-    srand((unsigned)time(NULL));
-
-    predict_allocated = 1;
+    s->xq = malloc(max_input);
+    if (!s->x || !s->xq) {
+        printf("Error: Could not allocate an inference session\n");
+        exit(1);
+    }
+    s->num_layers = num_hidden_layers;
+    s->top_k = sample_top_k;
+    s->top_p = sample_top_p;
+    s->temperature = sample_temperature;
+    if (seed == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        seed = ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) ^
+               ((uint64_t)(size_t)s << 16) ^ __atomic_add_fetch(&sessions_created, 1, __ATOMIC_RELAXED);
+    }
+    s->rng = rng_seed(seed);
+    return s;
 }
 
-void predict_cleanup()
+void brook_session_free(brook_session* s)
 {
-    if (!predict_allocated) return;
-
-    free(predict_x);
-    for (int i = 0; i < num_hidden_layers; ++i) free(predict_h[i]);
-    free(predict_h);
-    free(predict_logits);
-    free(predict_top_idx);
-    free(predict_top_val);
-
-    predict_x = NULL;
-    predict_h = NULL;
-    predict_logits = NULL;
-    predict_top_idx = NULL;
-    predict_top_val = NULL;
-    predict_allocated = 0;
+    if (!s) return;
+    free(s->x);
+    free(s->xq);
+    for (int i = 0; i < s->num_layers; ++i) {
+        free(s->h[i]);
+        free(s->batch_h[i]);
+    }
+    free(s->batch_x);
+    free(s->batch_logits);
+    free(s->tree_logp);
+    free(s);
 }
 
-int predict(int* context, int context_len)
+// Builds the input vector x (MAX_EMBED) for a context: the position
+// weighted sum of embeddings, matching training. Returns the effective
+// context length, 0 if it is empty.
+static int build_context_input(const int* context, int context_len, float* x)
 {
-    if (!predict_allocated) {
-        // Auto-init if user forgot (optional)
-        predict_init();
-    }
-
-    if (context_len <= 0) return 0;
-
     // effective context (match training)
     int effective_context = context_len > context_window ? context_window : context_len;
     if (effective_context > MAX_CONTEXT) effective_context = MAX_CONTEXT;
     if (effective_context <= 0) return 0;
 
     // Build input vector x: zero then accumulate embeddings + positional
-    for (int j = 0; j < MAX_EMBED; ++j) predict_x[j] = 0.0f;
+    for (int j = 0; j < MAX_EMBED; ++j) x[j] = 0.0f;
 
     for (int i = 0; i < effective_context; ++i) {
         int id = context[i];
@@ -90,100 +104,462 @@ int predict(int* context, int context_len)
         float *emb = embed[id];
         float *pos = pos_embed[i % MAX_CONTEXT];
         for (int j = 0; j < MAX_EMBED; ++j) {
-            predict_x[j] += pos_w * (emb[j] + pos[j]);
+            x[j] += pos_w * (emb[j] + pos[j]);
         }
     }
+    return effective_context;
+}
+
+// Builds the projection table or MIPS index on first use. Sessions on
+// other threads may race here, so the check is repeated under a lock.
+static void ensure_caches(int projected, int approx)
+{
+    if ((!projected || projection_current()) && (!approx || mips_current())) return;
+    pthread_mutex_lock(&cache_lock);
+    if (projected && !projection_current()) build_projection();
+    if (approx && !mips_current()) build_mips_index();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Runs the hidden layers for a context and returns the last layer's
+// activations (in the session's h), or NULL for an empty context. With
+// quantized set the matvecs use the int8 weights from quant.c.
+static float* predict_hidden(brook_session* s, const int* context, int context_len, int quantized)
+{
+    if (context_len <= 0) return NULL;
+
+    int effective_context = build_context_input(context, context_len, s->x);
+    if (!effective_context) return NULL;
+    int projected = use_projection && !quantized;
+    ensure_caches(projected, 0);
 
     // Forward through hidden layers (no dropout)
-    float *h_prev = predict_x;
+    float *h_prev = s->x;
     for (int layer = 0; layer < num_hidden_layers; ++layer) {
         int current_size = hidden_sizes[layer];
         int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
 
-        fast_matmul(W[layer], h_prev, predict_h[layer], current_size, input_size);
+        if (layer == 0 && projected) {
+            project_context(context, effective_context, s->h[0]);
+        } else if (quantized) {
+            quant_matvec(Wq[layer], Wq_scale[layer], h_prev, s->xq, s->h[layer], current_size, input_size);
+        } else {
+            fast_matmul(W[layer], h_prev, s->h[layer], current_size, input_size);
+        }
         // relu without dropout - train_flag = 0
-        relu_and_dropout_combined(predict_h[layer], current_size, DROPOUT_RATE, 0);
-        h_prev = predict_h[layer];
+        relu_and_dropout_combined(s->h[layer], current_size, DROPOUT_RATE, NULL);
+        h_prev = s->h[layer];
     }
+    return h_prev;
+}
+
+// Last hidden layer activations for a context (fp32), or NULL for an
+// empty context. Valid until the session's next prediction.
+const float* context_hidden(brook_session* s, const int* context, int context_len)
+{
+    return predict_hidden(s, context, context_len, 0);
+}
 
-    // Output logits (zero and matmul)
+static void batch_alloc(brook_session* s);
+
+// Output-layer logits for every vocabulary word, written to logits
+// (vocab_size floats); under the tree softmax, the tree's log-probs.
+// Returns 0 for an empty context.
+int context_logits(brook_session* s, const int* context, int context_len, float* logits, int quantized)
+{
+    quantized = quantized && quant_ready && quant_vocab_size == vocab_size;
+    float* h_prev = predict_hidden(s, context, context_len, quantized);
+    if (!h_prev) return 0;
     int final_layer_size = hidden_sizes[num_hidden_layers - 1];
-    int max_consider = (vocab_size < OUTPUT_SIZE) ? vocab_size : OUTPUT_SIZE;
-    for (int i = 0; i < OUTPUT_SIZE; ++i) predict_logits[i] = 0.0f;
-    fast_matmul(W_output, h_prev, predict_logits, OUTPUT_SIZE, final_layer_size);
-
-    // Find global max_logit across the vocab (for numerical stability)
-    float max_logit = -FLT_MAX;
-    for (int i = 0; i < max_consider; ++i) {
-        if (predict_logits[i] > max_logit) max_logit = predict_logits[i];
-    }
-
-    // Decide top_k (you previously used 5). Keep same behavior but allow <= vocab_size.
-    int top_k = 5;
-    if (top_k > max_consider) top_k = max_consider;
-
-    // Initialize top_k arrays with the first top_k logits (we'll track the minimum)
-    int filled = 0;
-    float cur_min = FLT_MAX;
-    int cur_min_idx = -1;
-    for (int i = 0; i < max_consider; ++i) {
-        float val = predict_logits[i];
-        if (filled < top_k) {
-            predict_top_idx[filled] = i;
-            predict_top_val[filled] = val;
-            filled++;
-            if (val < cur_min) { cur_min = val; cur_min_idx = filled - 1; }
-            if (filled == top_k) {
-                // ensure we have correct cur_min/cur_min_idx
-                cur_min = predict_top_val[0];
-                cur_min_idx = 0;
-                for (int k = 1; k < top_k; ++k) {
-                    if (predict_top_val[k] < cur_min) { cur_min = predict_top_val[k]; cur_min_idx = k; }
-                }
-            }
+    if (tree_in_use()) {
+        batch_alloc(s);
+        simd->matvec(W_tree, h_prev, s->tree_logp, vocab_size - 1, final_layer_size);
+        tree_log_probs(s->tree_logp, &s->tree_logp[vocab_size], logits);
+    } else if (quantized) {
+        quant_matvec(Wq_output, Wq_output_scale, h_prev, s->xq, logits, vocab_size, final_layer_size);
+    } else {
+        fast_matmul(W_output, h_prev, logits, vocab_size, final_layer_size);
+    }
+    return 1;
+}
+
+// Streaming top-k over output logits, fed one tile at a time. Keeps a
+// min-heap of the k best logits and, when top-p needs the true
+// probabilities, an online softmax denominator (running max, rescaled sum).
+typedef struct {
+    int k, count;
+    int idx[MAX_TOP_K];
+    float val[MAX_TOP_K];        // min-heap on val
+    int track_sum;
+    float inv_temp;
+    float max;                   // running max logit
+    float sum;                   // sum of exp((logit - max) * inv_temp)
+    const int* masked;           // ids whose logits are forced to MASKED_LOGIT
+    int n_masked;
+} top_k_state;
+
+static void top_k_begin(top_k_state* s, int k, int track_sum, float temperature)
+{
+    if (k > MAX_TOP_K) k = MAX_TOP_K;
+    if (k < 1) k = 1;
+    s->k = k;
+    s->count = 0;
+    s->track_sum = track_sum;
+    s->inv_temp = 1.0f / temperature;
+    s->max = -FLT_MAX;
+    s->sum = 0.0f;
+    s->masked = NULL;
+    s->n_masked = 0;
+}
+
+static void top_k_push(top_k_state* s, int id, float v)
+{
+    int i;
+    if (s->count < s->k) {
+        // sift up
+        i = s->count++;
+        while (i > 0 && s->val[(i - 1) / 2] > v) {
+            s->val[i] = s->val[(i - 1) / 2];
+            s->idx[i] = s->idx[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else {
+        // replace the root, sift down
+        i = 0;
+        for (;;) {
+            int c = 2 * i + 1;
+            if (c >= s->count) break;
+            if (c + 1 < s->count && s->val[c + 1] < s->val[c]) c++;
+            if (s->val[c] >= v) break;
+            s->val[i] = s->val[c];
+            s->idx[i] = s->idx[c];
+            i = c;
+        }
+    }
+    s->val[i] = v;
+    s->idx[i] = id;
+}
+
+// Feeds logits tile[0..n) for ids base..base+n, or ids[0..n) when ids is
+// not NULL. The tile is overwritten when the softmax sum is tracked.
+static void top_k_feed(top_k_state* s, float* tile, int base, const int* ids, int n)
+{
+    for (int m = 0; m < s->n_masked; ++m) {
+        int id = s->masked[m];
+        if (!ids) {
+            if (id >= base && id < base + n) tile[id - base] = MASKED_LOGIT;
+            continue;
+        }
+        for (int i = 0; i < n; ++i)
+            if (ids[i] == id) tile[i] = MASKED_LOGIT;
+    }
+    float tile_max = simd->max(tile, n);
+    // Whole tiles below the current k-th best are rejected with one compare
+    if (s->count < s->k || tile_max > s->val[0]) {
+        for (int i = 0; i < n; ++i) {
+            if (s->count < s->k || tile[i] > s->val[0]) top_k_push(s, ids ? ids[i] : base + i, tile[i]);
+        }
+    }
+    if (!s->track_sum) {
+        if (tile_max > s->max) s->max = tile_max;
+        return;
+    }
+    if (tile_max > s->max) {
+        if (s->sum > 0.0f) s->sum *= expf((s->max - tile_max) * s->inv_temp);
+        s->max = tile_max;
+    }
+    simd->scale(tile, n, s->inv_temp);
+    s->sum += simd->exp_sum(tile, n, s->max * s->inv_temp);
+}
+
+// Sorts the kept candidates best first. Returns how many there are.
+static int top_k_sorted(top_k_state* s)
+{
+    for (int i = 1; i < s->count; ++i) {
+        float v = s->val[i];
+        int id = s->idx[i], j = i;
+        while (j > 0 && s->val[j - 1] < v) {
+            s->val[j] = s->val[j - 1];
+            s->idx[j] = s->idx[j - 1];
+            j--;
+        }
+        s->val[j] = v;
+        s->idx[j] = id;
+    }
+    return s->count;
+}
+
+// Samples from the kept candidates: top-p prefix by true probability
+// (if tracked) and renormalized over what is left
+static int top_k_sample(top_k_state* s, float top_p, uint64_t* rng)
+{
+    int n = top_k_sorted(s);
+    if (n == 0) return 0;
+    float weights[MAX_TOP_K];
+    float kept = 0.0f;
+    int keep = n;
+    for (int i = 0; i < n; ++i) {
+        weights[i] = expf((s->val[i] - s->max) * s->inv_temp);
+        kept += weights[i];
+        if (s->track_sum && kept >= top_p * s->sum) { keep = i + 1; break; }
+    }
+    if (keep < n) {
+        kept = 0.0f;
+        for (int i = 0; i < keep; ++i) kept += weights[i];
+    }
+    float r = rng_float(rng) * kept;
+    float cumsum = 0.0f;
+    for (int i = 0; i < keep; ++i) {
+        cumsum += weights[i];
+        if (r <= cumsum) return s->idx[i];
+    }
+    return s->idx[keep - 1];
+}
+
+// Applies the session's sampling settings to a filled top-k state
+static int sample_top(brook_session* session, top_k_state* s)
+{
+    if (session->temperature <= 0.0f) {
+        // Greedy
+        top_k_sorted(s);
+        return s->count ? s->idx[0] : 0;
+    }
+    return top_k_sample(s, session->top_p, &session->rng);
+}
+
+static int wants_sum(const brook_session* session)
+{
+    return session->top_p < 1.0f && session->temperature > 0.0f;
+}
+
+static float safe_temperature(const brook_session* session)
+{
+    return session->temperature > 0.0f ? session->temperature : 1.0f;
+}
+
+// Samples a token from one row of vocab_size materialized logits, with
+// the n_masked ids in masked excluded as in predict_masked
+static int sample_logits(brook_session* session, const float* logits, const int* masked, int n_masked)
+{
+    top_k_state s;
+    float tile[OUTPUT_TILE];
+    top_k_begin(&s, session->top_k, wants_sum(session), safe_temperature(session));
+    s.masked = masked;
+    s.n_masked = n_masked;
+    for (int j = 0; j < vocab_size; j += OUTPUT_TILE) {
+        int n = (vocab_size - j < OUTPUT_TILE) ? vocab_size - j : OUTPUT_TILE;
+        memcpy(tile, &logits[j], n * sizeof(float));
+        top_k_feed(&s, tile, j, NULL, n);
+    }
+    return sample_top(session, &s);
+}
+
+// Approximate output_stream: exact scores for the rows of the MIPS
+// lists nearest to h only (mips.c)
+static void mips_stream(top_k_state* s, const float* h)
+{
+    int cols = hidden_sizes[num_hidden_layers - 1];
+    int lists[MIPS_MAX_LISTS];
+    float tile[OUTPUT_TILE];
+    int nprobe = mips_probe(h, mips_probe_count(), lists);
+    for (int l = 0; l < nprobe; ++l) {
+        const float* rows;
+        const int* ids;
+        int count = mips_list(lists[l], &rows, &ids);
+        for (int j = 0; j < count; j += OUTPUT_TILE) {
+            int n = (count - j < OUTPUT_TILE) ? count - j : OUTPUT_TILE;
+            simd->matvec(&rows[(size_t)j * cols], h, tile, n, cols);
+            top_k_feed(s, tile, 0, &ids[j], n);
+        }
+    }
+}
+
+// Fused output projection: computes the logits of h one OUTPUT_TILE rows
+// at a time into a stack tile and streams them into the top-k state, so
+// no vocab_size logits buffer is written or reread. With approx set and
+// a current MIPS index, only the probed lists are scored. xq is the int8
+// scratch for the quantized path.
+static void output_stream(top_k_state* s, const float* h, int8_t* xq, int quantized, int approx)
+{
+    if (approx && !quantized) {
+        ensure_caches(0, 1);
+        mips_stream(s, h);
+        return;
+    }
+    int cols = hidden_sizes[num_hidden_layers - 1];
+    float tile[OUTPUT_TILE];
+    for (int j = 0; j < vocab_size; j += OUTPUT_TILE) {
+        int n = (vocab_size - j < OUTPUT_TILE) ? vocab_size - j : OUTPUT_TILE;
+        if (quantized) {
+            quant_matvec(&Wq_output[(size_t)j * cols], &Wq_output_scale[j], h, xq, tile, n, cols);
         } else {
-            // If current logit > current minimum in top_k, replace it and update min
-            if (val > cur_min) {
-                predict_top_idx[cur_min_idx] = i;
-                predict_top_val[cur_min_idx] = val;
-                // recompute min and index (cost = O(top_k) but top_k is small)
-                cur_min = predict_top_val[0];
-                cur_min_idx = 0;
-                for (int k = 1; k < top_k; ++k) {
-                    if (predict_top_val[k] < cur_min) { cur_min = predict_top_val[k]; cur_min_idx = k; }
-                }
-            }
+            simd->matvec(&W_output[(size_t)j * cols], h, tile, n, cols);
         }
+        top_k_feed(s, tile, j, NULL, n);
     }
+}
 
-    // Compute (stable) softmax over top_k only: exp((logit - max_logit)/T) with clamping
-    float sum_exp = 0.0f;
-    for (int k = 0; k < top_k; ++k) {
-        // Use the global max_logit for stability.
-        float z = (predict_top_val[k] - max_logit) / (TEMPERATURE <= 0.0f ? 1e-6f : TEMPERATURE);
+/**
+ * The k largest output logits for last-layer activations h, best first,
+ * without materializing the full logits row. With approx set they come
+ * from the probed MIPS lists only. Returns the count (<= k).
+ */
+int output_top_k(const float* h, int k, int approx, int* idx, float* val)
+{
+    top_k_state s;
+    top_k_begin(&s, k, 0, 1.0f);
+    output_stream(&s, h, NULL, 0, approx);
+    int n = top_k_sorted(&s);
+    memcpy(idx, s.idx, n * sizeof(int));
+    memcpy(val, s.val, n * sizeof(float));
+    return n;
+}
 
-        // clamp z to avoid overflow/underflow
-        if (z > 50.0f) z = 50.0f;
-        if (z < -50.0f) z = -50.0f;
+int predict(brook_session* session, const int* context, int context_len)
+{
+    return predict_masked(session, context, context_len, NULL, 0);
+}
+
+/**
+ * predict() with the n_masked ids in masked excluded from sampling: their
+ * logits are replaced by MASKED_LOGIT as the output tiles stream past,
+ * so a banned token never needs a second prediction. The tree softmax
+ * samples by walking the tree and ignores the mask.
+ */
+int predict_masked(brook_session* session, const int* context, int context_len,
+                   const int* masked, int n_masked)
+{
+    int quantized = use_quantized && quant_ready && quant_vocab_size == vocab_size;
+    float* h_prev = predict_hidden(session, context, context_len, quantized);
+    if (!h_prev) return 0;
 
-        // store the exp in-place (reuse predict_top_val to hold exp values now)
-        float e = expf(z);
-        predict_top_val[k] = e;
-        sum_exp += e;
+    // Hierarchical softmax: sample by walking the tree, O(log V)
+    if (tree_in_use()) {
+        return tree_sample(h_prev, safe_temperature(session), &session->rng);
     }
 
-    // normalize (safeguard if sum_exp == 0)
-    if (!(sum_exp > 0.0f)) sum_exp = 1e-12f;
-    for (int k = 0; k < top_k; ++k) predict_top_val[k] /= sum_exp;
+    top_k_state s;
+    top_k_begin(&s, session->top_k, wants_sum(session), safe_temperature(session));
+    s.masked = masked;
+    s.n_masked = n_masked;
+    output_stream(&s, h_prev, session->xq, quantized, use_mips);
+    return sample_top(session, &s);
+}
 
-    // Sample from the top-k distribution
-    float r = (float)rand() / (float)RAND_MAX;
-    float cumsum = 0.0f;
-    int selected = predict_top_idx[0];
-    for (int k = 0; k < top_k; ++k) {
-        cumsum += predict_top_val[k];
-        if (r <= cumsum) { selected = predict_top_idx[k]; break; }
+static void batch_alloc(brook_session* s)
+{
+    if (!s->batch_x) {
+        s->batch_x = alloc_aligned((size_t)PREDICT_BATCH_ROWS * MAX_EMBED * sizeof(float));
+        for (int i = 0; i < s->num_layers; ++i) {
+            s->batch_h[i] = alloc_aligned((size_t)PREDICT_BATCH_ROWS * hidden_sizes[i] * sizeof(float));
+            if (!s->batch_h[i]) {
+                printf("Error: Could not allocate batch activations\n");
+                exit(1);
+            }
+        }
     }
+    if (vocab_size > s->batch_logits_cols) {
+        s->batch_logits_cols = vocab_size;
+        free(s->batch_logits);
+        free(s->tree_logp);
+        s->batch_logits = alloc_aligned((size_t)PREDICT_BATCH_ROWS * s->batch_logits_cols * sizeof(float));
+        s->tree_logp = malloc((size_t)2 * s->batch_logits_cols * sizeof(float));
+    }
+    if (!s->batch_x || !s->batch_logits || !s->tree_logp) {
+        printf("Error: Could not allocate batch buffers\n");
+        exit(1);
+    }
+}
+
+/**
+ * Evaluates n contexts together; contexts[b] holds context_lens[b] ids.
+ * Each hidden layer and the output projection run as one GEMM per block
+ * of PREDICT_BATCH_ROWS contexts, so a weight tile is read once per block
+ * instead of once per context. Writes n sampled tokens to out_tokens
+ * and, if logits is not NULL, n rows of vocab_size logits. Either output
+ * may be NULL. Empty contexts give token 0 and zero logits, as predict.
+ * If masked is not NULL, row b samples as predict_masked with the
+ * n_masked[b] ids at masked[b * GENERATOR_MASKED]; the logits written
+ * out are left unmasked.
+ */
+void predict_batch(brook_session* session, const int* const* contexts, const int* context_lens, int n,
+                   const int* masked, const int* n_masked, int* out_tokens, float* logits)
+{
+    batch_alloc(session);
+    int quantized = use_quantized && quant_ready && quant_vocab_size == vocab_size;
+    int use_tree = tree_in_use();
+    int projected = use_projection && !quantized;
+    ensure_caches(projected, 0);
+    int final_layer_size = hidden_sizes[num_hidden_layers - 1];
+    float temperature = safe_temperature(session);
+    int valid[PREDICT_BATCH_ROWS];   // effective context length, 0 if empty
+
+    for (int b0 = 0; b0 < n; b0 += PREDICT_BATCH_ROWS) {
+        int rows = (n - b0 < PREDICT_BATCH_ROWS) ? n - b0 : PREDICT_BATCH_ROWS;
+        for (int r = 0; r < rows; ++r) {
+            float* x = &session->batch_x[(size_t)r * MAX_EMBED];
+            valid[r] = build_context_input(contexts[b0 + r], context_lens[b0 + r], x);
+            if (!valid[r]) memset(x, 0, MAX_EMBED * sizeof(float));
+        }
 
-    return selected;
+        float* h_prev = session->batch_x;
+        for (int layer = 0; layer < num_hidden_layers; ++layer) {
+            int current_size = hidden_sizes[layer];
+            int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+            float* h = session->batch_h[layer];
+            if (layer == 0 && projected) {
+                for (int r = 0; r < rows; ++r) {
+                    if (valid[r]) project_context(contexts[b0 + r], valid[r], &h[(size_t)r * current_size]);
+                    else memset(&h[(size_t)r * current_size], 0, current_size * sizeof(float));
+                }
+            } else if (quantized) {
+                // No int8 GEMM; the int8 weights are already 4x smaller
+                for (int r = 0; r < rows; ++r) {
+                    quant_matvec(Wq[layer], Wq_scale[layer], &h_prev[(size_t)r * input_size], session->xq,
+                                 &h[(size_t)r * current_size], current_size, input_size);
+                }
+            } else {
+                fast_gemm_nt(h_prev, W[layer], h, rows, current_size, input_size);
+            }
+            relu_and_dropout_combined(h, rows * current_size, DROPOUT_RATE, NULL);
+            h_prev = h;
+        }
+
+        // Tree sampling needs no logits
+        if (use_tree && !logits) {
+            for (int r = 0; r < rows && out_tokens; ++r) {
+                out_tokens[b0 + r] = valid[r] ? tree_sample(&h_prev[(size_t)r * final_layer_size], temperature, &session->rng) : 0;
+            }
+            continue;
+        }
+
+        float* out = logits ? &logits[(size_t)b0 * vocab_size] : session->batch_logits;
+        if (use_tree) {
+            // Inner-node scores for the block, then each row's leaf log-probs
+            fast_gemm_nt(h_prev, W_tree, session->batch_logits, rows, vocab_size - 1, final_layer_size);
+            for (int r = 0; r < rows; ++r) {
+                tree_log_probs(&session->batch_logits[(size_t)r * (vocab_size - 1)], session->tree_logp,
+                               &out[(size_t)r * vocab_size]);
+            }
+        } else if (quantized) {
+            for (int r = 0; r < rows; ++r) {
+                quant_matvec(Wq_output, Wq_output_scale, &h_prev[(size_t)r * final_layer_size], session->xq,
+                             &out[(size_t)r * vocab_size], vocab_size, final_layer_size);
+            }
+        } else {
+            fast_gemm_nt(h_prev, W_output, out, rows, vocab_size, final_layer_size);
+        }
+        for (int r = 0; r < rows; ++r) {
+            float* row = &out[(size_t)r * vocab_size];
+            if (!valid[r]) {
+                memset(row, 0, vocab_size * sizeof(float));
+                if (out_tokens) out_tokens[b0 + r] = 0;
+            } else if (out_tokens) {
+                out_tokens[b0 + r] = use_tree ? tree_sample(&h_prev[(size_t)r * final_layer_size], temperature, &session->rng)
+                                              : sample_logits(session, row,
+                                                              masked ? &masked[(size_t)(b0 + r) * GENERATOR_MASKED] : NULL,
+                                                              masked ? n_masked[b0 + r] : 0);
+            }
+        }
+    }
 }
@@ -0,0 +1,197 @@
+// Training profiler.
+// Always on: the training loop brackets each phase (forward, softmax,
+// backward, gradient reduction, update) and each layer's forward and
+// backward work with now_seconds()/prof_add() on the monotonic clock, about
+// a dozen clock reads per sample. Counters are per training thread, so
+// workers never share a cache line while an epoch runs, and are summed
+// for the report. FLOPs are the nominal dense counts of each matrix
+// product (dead ReLU rows that are skipped still count).
+// "profile trace FILE" additionally records every interval of the next
+// epoch and writes them as Chrome trace-event JSON (chrome://tracing,
+// Perfetto).
+#include "brook.h"
+
+typedef struct {
+    double seconds;
+    double flops;
+    long calls;
+} prof_counter;
+
+typedef struct {
+    int slot;
+    double start, end;
+} prof_event;
+
+// One row of counters per thread, padded apart
+typedef struct {
+    prof_counter c[PROF_SLOTS];
+    char pad[64];
+} prof_row;
+
+static prof_row prof_rows[MAX_THREADS];
+static long prof_samples = 0;
+static int prof_epochs = 0;
+static int prof_threads = 1;
+
+static char* trace_path = NULL;     // armed: trace the next epoch
+static int tracing = 0;
+static double trace_origin = 0.0;
+static prof_event* trace_events[MAX_THREADS];
+static int trace_count[MAX_THREADS];
+static int trace_capacity = 0;
+static long trace_dropped = 0;
+
+/**
+ * Charges the interval from start to now to slot on training thread
+ * thread, with flops nominal FLOPs. Returns now, so back-to-back phases
+ * can chain: t = prof_add(id, PROF_FORWARD, t, f).
+ */
+double prof_add(int thread, int slot, double start, double flops) {
+    double end = now_seconds();
+    prof_counter* c = &prof_rows[thread].c[slot];
+    c->seconds += end - start;
+    c->flops += flops;
+    c->calls++;
+    if (tracing) {
+        if (trace_count[thread] < trace_capacity) {
+            prof_event* e = &trace_events[thread][trace_count[thread]++];
+            e->slot = slot;
+            e->start = start;
+            e->end = end;
+        } else {
+            __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return end;
+}
+
+void prof_reset() {
+    memset(prof_rows, 0, sizeof(prof_rows));
+    prof_samples = 0;
+    prof_epochs = 0;
+}
+
+// Writes the next epoch's intervals to path ("profile trace FILE")
+void prof_trace_next_epoch(const char* path) {
+    free(trace_path);
+    trace_path = malloc(strlen(path) + 1);
+    if (!trace_path) return;
+    strcpy(trace_path, path);
+}
+
+static void slot_name(int slot, char* out, size_t size) {
+    static const char* phases[] = { "forward", "softmax", "backward", "reduce", "update", "epoch" };
+    if (slot < PROF_LAYER_FWD) {
+        snprintf(out, size, "%s", phases[slot]);
+    } else if (slot < PROF_LAYER_BWD) {
+        int layer = slot - PROF_LAYER_FWD;
+        if (layer == MAX_HIDDEN_LAYERS) snprintf(out, size, "forward output");
+        else snprintf(out, size, "forward L%d", layer);
+    } else {
+        int layer = slot - PROF_LAYER_BWD;
+        if (layer == MAX_HIDDEN_LAYERS) snprintf(out, size, "backward output");
+        else snprintf(out, size, "backward L%d", layer);
+    }
+}
+
+/**
+ * Marks the start of an epoch of samples samples on threads threads.
+ * Allocates the trace buffers when a trace is armed.
+ */
+void prof_epoch_begin(int samples, int threads) {
+    prof_threads = threads;
+    if (!trace_path) return;
+    // Each sample records its phases plus a forward and backward per layer
+    long per_thread = ((long)samples / threads + 1) * (3 + 2 * (num_hidden_layers + 1)) + 16;
+    trace_capacity = per_thread < PROF_TRACE_MAX_EVENTS ? (int)per_thread : PROF_TRACE_MAX_EVENTS;
+    for (int t = 0; t < threads; t++) {
+        trace_events[t] = malloc((size_t)trace_capacity * sizeof(prof_event));
+        trace_count[t] = 0;
+        if (!trace_events[t]) {
+            printf("Error: Could not allocate the trace buffer\n");
+            exit(1);
+        }
+    }
+    trace_dropped = 0;
+    trace_origin = now_seconds();
+    tracing = 1;
+}
+
+static void write_trace(int epoch) {
+    FILE* f = fopen(trace_path, "w");
+    if (!f) {
+        printf("Error: Could not write %s\n", trace_path);
+        return;
+    }
+    long events = 0;
+    char name[32];
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"epoch\": %d}, \"traceEvents\": [\n", epoch);
+    for (int t = 0; t < prof_threads; t++) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}}",
+                t ? ",\n" : "", t, t);
+        for (int i = 0; i < trace_count[t]; i++) {
+            const prof_event* e = &trace_events[t][i];
+            slot_name(e->slot, name, sizeof(name));
+            fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    name, e->slot < PROF_LAYER_FWD ? "phase" : "layer", t,
+                    1e6 * (e->start - trace_origin), 1e6 * (e->end - e->start));
+            events++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("Wrote %ld trace events for epoch %d to %s", events, epoch, trace_path);
+    if (trace_dropped) printf(" (%ld dropped: buffer full)", trace_dropped);
+    printf("\n");
+}
+
+// Ends an epoch: counts its samples and writes the trace if one ran
+void prof_epoch_end(int epoch, int samples, double start) {
+    prof_add(0, PROF_EPOCH, start, 0.0);
+    prof_samples += samples;
+    prof_epochs++;
+    if (!tracing) return;
+    tracing = 0;
+    write_trace(epoch);
+    for (int t = 0; t < prof_threads; t++) {
+        free(trace_events[t]);
+        trace_events[t] = NULL;
+    }
+    free(trace_path);
+    trace_path = NULL;
+}
+
+/** Prints cumulative time, calls and FLOP/s per phase and per layer. */
+void prof_report() {
+    prof_counter total[PROF_SLOTS];
+    memset(total, 0, sizeof(total));
+    for (int t = 0; t < MAX_THREADS; t++) {
+        for (int s = 0; s < PROF_SLOTS; s++) {
+            total[s].seconds += prof_rows[t].c[s].seconds;
+            total[s].flops += prof_rows[t].c[s].flops;
+            total[s].calls += prof_rows[t].c[s].calls;
+        }
+    }
+    double wall = total[PROF_EPOCH].seconds;
+    if (prof_epochs == 0 || wall <= 0.0) {
+        printf("No training profiled yet\n");
+        return;
+    }
+    double thread_time = wall * prof_threads;
+    printf("Training profile: %d epoch%s, %ld samples in %.3fs (%.0f samples/s, %d thread%s)\n",
+           prof_epochs, prof_epochs == 1 ? "" : "s", prof_samples, wall, prof_samples / wall,
+           prof_threads, prof_threads == 1 ? "" : "s");
+    printf("  %-16s %10s %10s %7s %10s %9s\n", "phase", "calls", "seconds", "%", "us/call", "GFLOP/s");
+    char name[32];
+    for (int s = 0; s < PROF_SLOTS; s++) {
+        if (s == PROF_EPOCH || total[s].calls == 0) continue;
+        slot_name(s, name, sizeof(name));
+        printf("  %-16s %10ld %10.3f %7.1f %10.2f", name, total[s].calls, total[s].seconds,
+               100.0 * total[s].seconds / thread_time, 1e6 * total[s].seconds / total[s].calls);
+        if (total[s].flops > 0.0) printf(" %9.2f", 1e-9 * total[s].flops / total[s].seconds);
+        printf("\n");
+    }
+    double flops = 0.0;
+    for (int s = PROF_FORWARD; s <= PROF_UPDATE; s++) flops += total[s].flops;
+    printf("  overall %.2f GFLOP/s; phase %% is of %.3fs thread time\n", 1e-9 * flops / wall, thread_time);
+}
@@ -0,0 +1,100 @@
+// First-layer projection table.
+// The layer 0 input is a position-weighted sum of embed[id] + pos_embed[p],
+// and W[0] is linear before the ReLU, so
+//     W0 x = sum_p w_p (W0 embed[id_p] + W0 pos_embed[p]).
+// proj_table holds W0 embed[id] for every vocabulary row and
+// proj_pos_sum[L] the position term for an L-token context, so the layer 0
+// matvec becomes one copy and effective_context axpys of hidden_sizes[0]
+// floats. The table depends on embed and W[0] and must be invalidated
+// (invalidate_projection) whenever either changes.
+#include "brook.h"
+
+int use_projection = 0;          // predict() reads layer 0 from the table
+int freeze_embeddings = 0;       // training keeps embed/pos_embed fixed and uses the table
+
+static float* proj_table = NULL;     // proj_rows x hidden_sizes[0]
+static float* proj_pos = NULL;       // MAX_CONTEXT x hidden_sizes[0]
+static float* proj_pos_sum = NULL;   // (MAX_CONTEXT + 1) x hidden_sizes[0], by context length
+static int proj_rows = 0;
+static int proj_hidden = 0;
+static int proj_ready = 0;
+
+void free_projection() {
+    free(proj_table);
+    free(proj_pos);
+    free(proj_pos_sum);
+    proj_table = NULL;
+    proj_pos = NULL;
+    proj_pos_sum = NULL;
+    proj_rows = 0;
+    proj_hidden = 0;
+    proj_ready = 0;
+}
+
+void invalidate_projection() {
+    proj_ready = 0;
+}
+
+// Position weight of slot p in a context of len tokens (see build_input)
+static float position_weight(int p, int len) {
+    float w = 1.0f - (float)p / (float)len * (float)POSITIONAL_DECAY_RATE;
+    return (w < 0.0f) ? 0.0f : w;
+}
+
+/**
+ * Rebuilds the table from the current embed, pos_embed and W[0]:
+ * one vocab_size x MAX_EMBED by MAX_EMBED x hidden_sizes[0] product.
+ */
+void build_projection() {
+    int H = hidden_sizes[0];
+    if (vocab_size > proj_rows || H != proj_hidden) {
+        free(proj_table);
+        proj_table = malloc((size_t)vocab_size * H * sizeof(float));
+        proj_rows = vocab_size;
+    }
+    if (H != proj_hidden) {
+        free(proj_pos);
+        free(proj_pos_sum);
+        proj_pos = malloc((size_t)MAX_CONTEXT * H * sizeof(float));
+        proj_pos_sum = malloc((size_t)(MAX_CONTEXT + 1) * H * sizeof(float));
+        proj_hidden = H;
+    }
+    if (!proj_table || !proj_pos || !proj_pos_sum) {
+        printf("Error: Could not allocate the layer 0 projection table\n");
+        exit(1);
+    }
+    fast_gemm_nt(embed[0], W[0], proj_table, vocab_size, H, MAX_EMBED);
+    fast_gemm_nt(pos_embed[0], W[0], proj_pos, MAX_CONTEXT, H, MAX_EMBED);
+    for (int len = 0; len <= MAX_CONTEXT; len++) {
+        float* sum = &proj_pos_sum[(size_t)len * H];
+        memset(sum, 0, H * sizeof(float));
+        for (int p = 0; p < len; p++) {
+            simd->axpy(position_weight(p, len), &proj_pos[(size_t)p * H], sum, H);
+        }
+    }
+    proj_ready = 1;
+}
+
+// 1 if the table matches the current weights and vocabulary
+int projection_current() {
+    return proj_ready && proj_rows >= vocab_size && proj_hidden == hidden_sizes[0];
+}
+
+/**
+ * Layer 0 pre-activations for the first len tokens of context, read from
+ * the table (build_projection must be current). Invalid ids contribute
+ * nothing, as in the matvec path.
+ */
+void project_context(const int* context, int len, float* out) {
+    int H = proj_hidden;
+    memcpy(out, &proj_pos_sum[(size_t)len * H], H * sizeof(float));
+    for (int p = 0; p < len; p++) {
+        int id = context[p];
+        float w = position_weight(p, len);
+        if (id < 0 || id >= vocab_size) {
+            simd->axpy(-w, &proj_pos[(size_t)p * H], out, H);
+        } else {
+            simd->axpy(w, &proj_table[(size_t)id * H], out, H);
+        }
+    }
+}
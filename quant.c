@@ -0,0 +1,249 @@
+// Int8 quantized inference.
+// W[layer] and W_output are stored as per-row symmetric int8 with one fp32
+// scale per row (w ~= q * scale, |q| <= 127). At predict time the input
+// vector is quantized on the fly with a single scale, each row is an
+// int8 x int8 -> int32 dot product, and the result is rescaled by
+// row_scale * x_scale. Embeddings and the tree stay fp32: they are
+// lookups or O(log V) work, not bandwidth-bound matvecs.
+#include "brook.h"
+
+int quant_ready = 0;
+int use_quantized = 0;           // predict() runs the int8 path when set
+int8_t* Wq[MAX_HIDDEN_LAYERS];
+float* Wq_scale[MAX_HIDDEN_LAYERS];
+int8_t* Wq_output = NULL;        // quant_vocab_size x last hidden size
+float* Wq_output_scale = NULL;
+int quant_vocab_size = 0;
+
+void free_quantized() {
+    for (int i = 0; i < MAX_HIDDEN_LAYERS; i++) {
+        free(Wq[i]);
+        free(Wq_scale[i]);
+        Wq[i] = NULL;
+        Wq_scale[i] = NULL;
+    }
+    free(Wq_output);
+    free(Wq_output_scale);
+    Wq_output = NULL;
+    Wq_output_scale = NULL;
+    quant_vocab_size = 0;
+    quant_ready = 0;
+    use_quantized = 0;
+}
+
+static void quantize_rows(const float* Wf, int rows, int cols, int8_t* q, float* scale) {
+    for (int i = 0; i < rows; i++) {
+        const float* row = &Wf[(size_t)i * cols];
+        float max_abs = 0.0f;
+        for (int j = 0; j < cols; j++) {
+            if (fabsf(row[j]) > max_abs) max_abs = fabsf(row[j]);
+        }
+        scale[i] = (max_abs > 0.0f) ? max_abs / 127.0f : 1.0f;
+        float inv = 1.0f / scale[i];
+        for (int j = 0; j < cols; j++) {
+            q[(size_t)i * cols + j] = (int8_t)lrintf(row[j] * inv);
+        }
+    }
+}
+
+static void allocate_quantized() {
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+        Wq[layer] = malloc((size_t)hidden_sizes[layer] * input_size);
+        Wq_scale[layer] = malloc(hidden_sizes[layer] * sizeof(float));
+    }
+    int last_size = hidden_sizes[num_hidden_layers - 1];
+    Wq_output = malloc((size_t)quant_vocab_size * last_size);
+    Wq_output_scale = malloc(quant_vocab_size * sizeof(float));
+    if (!Wq_output || !Wq_output_scale) {
+        printf("Error: Could not allocate quantized weights\n");
+        exit(1);
+    }
+}
+
+/**
+ * Quantizes the current fp32 hidden and output weights. The copy is
+ * invalidated (free_quantized) whenever training changes the weights.
+ */
+void quantize_model() {
+    free_quantized();
+    quant_vocab_size = vocab_size;
+    allocate_quantized();
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+        quantize_rows(W[layer], hidden_sizes[layer], input_size, Wq[layer], Wq_scale[layer]);
+    }
+    quantize_rows(W_output, vocab_size, hidden_sizes[num_hidden_layers - 1], Wq_output, Wq_output_scale);
+    quant_ready = 1;
+}
+
+// out[rows] = dequant(q) * x, with x quantized on the fly into the
+// caller's xq scratch (cols bytes; a session's xq)
+void quant_matvec(const int8_t* q, const float* scale, const float* x, int8_t* xq,
+                  float* out, int rows, int cols) {
+    float max_abs = 0.0f;
+    for (int j = 0; j < cols; j++) {
+        if (fabsf(x[j]) > max_abs) max_abs = fabsf(x[j]);
+    }
+    if (max_abs == 0.0f) {
+        memset(out, 0, rows * sizeof(float));
+        return;
+    }
+    float x_scale = max_abs / 127.0f;
+    float inv = 1.0f / x_scale;
+    for (int j = 0; j < cols; j++) xq[j] = (int8_t)lrintf(x[j] * inv);
+    for (int i = 0; i < rows; i++) {
+        int acc = simd->dot_i8(&q[(size_t)i * cols], xq, cols);
+        out[i] = (float)acc * scale[i] * x_scale;
+    }
+}
+
+// Tagged with checkpoint_id, which is 0 while the live weights are newer
+// than any saved file; a save then rewrites weights.q8 with its new id.
+void save_quantized() {
+    if (quant_ready) save_file("weights.q8", write_quantized);
+}
+
+void write_quantized(FILE* f) {
+    int magic = QUANT_MAGIC, version = 2;
+    int last_size = hidden_sizes[num_hidden_layers - 1];
+    fwrite(&magic, sizeof(int), 1, f);
+    fwrite(&version, sizeof(int), 1, f);
+    fwrite(&checkpoint_id, sizeof(uint32_t), 1, f);
+    fwrite(&quant_vocab_size, sizeof(int), 1, f);
+    fwrite(&num_hidden_layers, sizeof(int), 1, f);
+    fwrite(hidden_sizes, sizeof(int), num_hidden_layers, f);
+    for (int layer = 0; layer < num_hidden_layers; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+        fwrite(Wq_scale[layer], sizeof(float), hidden_sizes[layer], f);
+        fwrite(Wq[layer], 1, (size_t)hidden_sizes[layer] * input_size, f);
+    }
+    fwrite(Wq_output_scale, sizeof(float), quant_vocab_size, f);
+    fwrite(Wq_output, 1, (size_t)quant_vocab_size * last_size, f);
+}
+
+/**
+ * Loads weights.q8 if present and it matches the loaded model's layers,
+ * vocabulary and checkpoint id (version 1 files have id 0). Embeddings
+ * come from weights.bin. Returns 1 on success.
+ */
+int load_quantized() {
+    FILE* f = fopen("weights.q8", "rb");
+    if (!f) return 0;
+    int magic, version, V, layers, sizes[MAX_HIDDEN_LAYERS];
+    uint32_t id = 0;
+    if (fread(&magic, sizeof(int), 1, f) != 1 || magic != QUANT_MAGIC ||
+        fread(&version, sizeof(int), 1, f) != 1 || version < 1 || version > 2 ||
+        (version == 2 && fread(&id, sizeof(uint32_t), 1, f) != 1) ||
+        fread(&V, sizeof(int), 1, f) != 1 ||
+        fread(&layers, sizeof(int), 1, f) != 1 ||
+        layers < 1 || layers > MAX_HIDDEN_LAYERS ||
+        fread(sizes, sizeof(int), layers, f) != (size_t)layers) {
+        printf("Error reading weights.q8 header\n");
+        fclose(f);
+        return 0;
+    }
+    if (V != vocab_size || layers != num_hidden_layers ||
+        memcmp(sizes, hidden_sizes, layers * sizeof(int)) != 0) {
+        printf("Ignoring weights.q8: it does not match the loaded model\n");
+        fclose(f);
+        return 0;
+    }
+    if (id != checkpoint_id) {
+        printf("Ignoring weights.q8: it was quantized from different weights than weights.bin\n");
+        fclose(f);
+        return 0;
+    }
+    free_quantized();
+    quant_vocab_size = V;
+    allocate_quantized();
+    int ok = 1;
+    for (int layer = 0; layer < num_hidden_layers && ok; layer++) {
+        int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+        size_t count = (size_t)hidden_sizes[layer] * input_size;
+        ok = fread(Wq_scale[layer], sizeof(float), hidden_sizes[layer], f) == (size_t)hidden_sizes[layer] &&
+             fread(Wq[layer], 1, count, f) == count;
+    }
+    size_t out_count = (size_t)V * hidden_sizes[num_hidden_layers - 1];
+    ok = ok && fread(Wq_output_scale, sizeof(float), V, f) == (size_t)V &&
+         fread(Wq_output, 1, out_count, f) == out_count;
+    fclose(f);
+    if (!ok) {
+        printf("Error reading weights.q8\n");
+        free_quantized();
+        return 0;
+    }
+    quant_ready = 1;
+    printf("Loaded weights.q8 (int8 inference available: int8 on)\n");
+    return 1;
+}
+
+// Indices of the k largest logits, best first
+static void top_k_indices(const float* logits, int n, int k, int* idx) {
+    for (int j = 0; j < k; j++) idx[j] = -1;
+    for (int i = 0; i < n; i++) {
+        int pos = k;
+        while (pos > 0 && (idx[pos - 1] < 0 || logits[i] > logits[idx[pos - 1]])) pos--;
+        if (pos >= k) continue;
+        for (int j = k - 1; j > pos; j--) idx[j] = idx[j - 1];
+        idx[pos] = i;
+    }
+}
+
+static float log_softmax_at(const float* logits, int n, int target) {
+    float max_logit = simd->max(logits, n);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += exp(logits[i] - max_logit);
+    return logits[target] - max_logit - (float)log(sum);
+}
+
+/**
+ * Compares int8 against fp32 next-token predictions on the first
+ * QUANT_EVAL_SAMPLES windows of the training tokens: top-1 agreement,
+ * top-5 overlap, perplexity of the true next token, and forward time.
+ */
+void quant_report() {
+    if (!quant_ready) return;
+    int ctx = context_window > MAX_CONTEXT ? MAX_CONTEXT : context_window;
+    int samples = token_count - ctx;
+    if (samples > QUANT_EVAL_SAMPLES) samples = QUANT_EVAL_SAMPLES;
+    if (samples <= 0) {
+        printf("No training tokens to evaluate the quantized model on\n");
+        return;
+    }
+    brook_session* session = brook_session_create(1);
+    float* ref = malloc(vocab_size * sizeof(float));
+    float* q8 = malloc(vocab_size * sizeof(float));
+    int ref_top[5], q8_top[5];
+    int top1 = 0, top5 = 0;
+    double ref_nll = 0.0, q8_nll = 0.0, ref_time = 0.0, q8_time = 0.0;
+
+    for (int i = 0; i < samples; i++) {
+        int target = tokens[i + ctx];
+        double t0 = now_seconds();
+        context_logits(session, &tokens[i], ctx, ref, 0);
+        double t1 = now_seconds();
+        context_logits(session, &tokens[i], ctx, q8, 1);
+        q8_time += now_seconds() - t1;
+        ref_time += t1 - t0;
+
+        top_k_indices(ref, vocab_size, 5, ref_top);
+        top_k_indices(q8, vocab_size, 5, q8_top);
+        if (ref_top[0] == q8_top[0]) top1++;
+        for (int a = 0; a < 5; a++)
+            for (int b = 0; b < 5; b++)
+                if (ref_top[a] == q8_top[b]) top5++;
+        ref_nll -= log_softmax_at(ref, vocab_size, target);
+        q8_nll -= log_softmax_at(q8, vocab_size, target);
+    }
+    printf("Int8 vs fp32 over %d samples:\n", samples);
+    printf("  top-1 agreement: %.2f%%, top-5 overlap: %.2f%%\n",
+           100.0 * top1 / samples, 100.0 * top5 / (5.0 * samples));
+    printf("  perplexity: fp32 %.3f, int8 %.3f (%+.2f%%)\n", exp(ref_nll / samples),
+           exp(q8_nll / samples), 100.0 * (exp((q8_nll - ref_nll) / samples) - 1.0));
+    printf("  forward time: fp32 %.1fus, int8 %.1fus per prediction\n",
+           1e6 * ref_time / samples, 1e6 * q8_time / samples);
+    free(ref);
+    free(q8);
+    brook_session_free(session);
+}
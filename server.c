@@ -0,0 +1,453 @@
+// Inference server: "brook serve [ADDRESS] [MAX_BATCH] [MAX_WAIT_MS]".
+// Listens on a Unix domain socket (ADDRESS is a path) or on a localhost
+// TCP port (ADDRESS is a number) and answers one request per line:
+//
+//   generate STEPS SEED...   ->  ok TEXT
+//   score TEXT               ->  ok TOKENS NLL PERPLEXITY
+//   stats                    ->  ok requests N p50_ms X p99_ms Y tokens_per_sec Z mean_batch B
+//   quit                         closes the connection
+//
+// Each connection has its own thread, which parses the request, queues it
+// and sleeps until it is done. A single scheduler thread owns the inference
+// session and runs the queued work as batched forward passes: every
+// in-flight generate request contributes one context per pass (new ones
+// join between passes), and every score request all of its positions.
+// When nothing is in flight, the scheduler holds the first request up to
+// MAX_WAIT_MS for up to MAX_BATCH requests to arrive.
+#include "brook.h"
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define REQUEST_GENERATE 0
+#define REQUEST_SCORE 1
+
+typedef struct serve_request {
+    int type;
+    int steps;                      // generate: forward passes to run
+    text_generator gen;
+    int score_tokens[SERVE_MAX_SCORE];
+    int score_count;
+    double nll;                     // score: summed -log p of tokens 1..count-1
+    double arrival;
+    int done;
+    pthread_cond_t cond;
+    struct serve_request* next;
+    char text[SERVE_MAX_TEXT];
+} serve_request;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond;
+static serve_request* queue_head = NULL;
+static serve_request* queue_tail = NULL;
+static int queue_len = 0;
+static int running = 1;
+static int max_batch = SERVE_DEFAULT_BATCH;
+static double max_wait = SERVE_DEFAULT_WAIT_MS * 1e-3;
+
+// Stats, guarded by queue_lock
+static double latencies[SERVE_LATENCY_SAMPLES];   // most recent, seconds
+static long requests_done = 0;
+static long tokens_done = 0;        // generated plus scored tokens
+static long passes = 0;
+static long pass_requests = 0;
+static double first_arrival = 0.0;
+static double last_done = 0.0;
+
+static volatile sig_atomic_t stop_requested = 0;
+static int listen_fd = -1;
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// The p-quantile (0..1) of v[n]; sorts v in place
+double percentile(double* v, int n, double p) {
+    if (n <= 0) return 0.0;
+    qsort(v, n, sizeof(double), compare_doubles);
+    return v[(int)(p * (n - 1) + 0.5)];
+}
+
+// Snapshot of the request stats; call with queue_lock held
+static void stats_snapshot(long* requests, double* p50, double* p99, double* tokens_per_sec, double* mean_batch) {
+    int n = requests_done < SERVE_LATENCY_SAMPLES ? (int)requests_done : SERVE_LATENCY_SAMPLES;
+    double* sorted = malloc((n ? n : 1) * sizeof(double));
+    memcpy(sorted, latencies, n * sizeof(double));
+    *requests = requests_done;
+    *p50 = 1e3 * percentile(sorted, n, 0.50);
+    *p99 = 1e3 * percentile(sorted, n, 0.99);
+    *tokens_per_sec = last_done > first_arrival ? tokens_done / (last_done - first_arrival) : 0.0;
+    *mean_batch = passes ? (double)pass_requests / passes : 0.0;
+    free(sorted);
+}
+
+static void finish_request(serve_request* r, double now) {
+    latencies[requests_done % SERVE_LATENCY_SAMPLES] = now - r->arrival;
+    requests_done++;
+    last_done = now;
+    r->done = 1;
+    pthread_cond_signal(&r->cond);
+}
+
+// -log softmax(row)[target]; overwrites row
+static double row_nll(float* row, int target) {
+    float max_logit = simd->max(row, vocab_size);
+    float target_logit = row[target];
+    float sum = simd->exp_sum(row, vocab_size, max_logit);
+    return (double)(logf(sum) + max_logit - target_logit);
+}
+
+/**
+ * One batched pass over the in-flight requests: a single predict_batch
+ * call advances every generate request by one token, then the positions
+ * of the score requests are evaluated together in blocks. Each generate
+ * row masks the tokens its generator would reject, so every pass yields
+ * a word per request.
+ */
+static void serve_pass(brook_session* session, serve_request** active, int n_active,
+                       const int** ctx, int* lens, int* masked, int* n_masked,
+                       int* next, int* target, float* logits) {
+    int rows = 0;
+    for (int i = 0; i < n_active; i++) {
+        if (active[i]->type != REQUEST_GENERATE) continue;
+        ctx[rows] = active[i]->gen.context;
+        lens[rows] = active[i]->gen.context_len;
+        n_masked[rows] = generator_masked(&active[i]->gen, &masked[(size_t)rows * GENERATOR_MASKED]);
+        rows++;
+    }
+    if (rows) {
+        predict_batch(session, ctx, lens, rows, masked, n_masked, next, NULL);
+        int row = 0;
+        for (int i = 0; i < n_active; i++) {
+            if (active[i]->type == REQUEST_GENERATE) generator_push(&active[i]->gen, next[row++]);
+        }
+    }
+    long tokens = rows;
+
+    // Score positions, SERVE_SCORE_ROWS per predict_batch call
+    serve_request* owner[SERVE_SCORE_ROWS];
+    rows = 0;
+    for (int i = 0; i <= n_active; i++) {
+        serve_request* r = i < n_active ? active[i] : NULL;
+        for (int t = 1; r && r->type == REQUEST_SCORE && t < r->score_count; t++) {
+            int start = t > context_window ? t - context_window : 0;
+            ctx[rows] = &r->score_tokens[start];
+            lens[rows] = t - start;
+            target[rows] = r->score_tokens[t];
+            owner[rows++] = r;
+            if (rows < SERVE_SCORE_ROWS) continue;
+            predict_batch(session, ctx, lens, rows, NULL, NULL, NULL, logits);
+            for (int k = 0; k < rows; k++) owner[k]->nll += row_nll(&logits[(size_t)k * vocab_size], target[k]);
+            tokens += rows;
+            rows = 0;
+        }
+        if (i == n_active && rows) {
+            predict_batch(session, ctx, lens, rows, NULL, NULL, NULL, logits);
+            for (int k = 0; k < rows; k++) owner[k]->nll += row_nll(&logits[(size_t)k * vocab_size], target[k]);
+            tokens += rows;
+        }
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    tokens_done += tokens;
+    passes++;
+    pass_requests += n_active;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void* scheduler_main(void* arg) {
+    (void)arg;
+    brook_session* session = brook_session_create(0);
+    serve_request** active = malloc(max_batch * sizeof(serve_request*));
+    int rows = max_batch > SERVE_SCORE_ROWS ? max_batch : SERVE_SCORE_ROWS;
+    const int** ctx = malloc(rows * sizeof(int*));
+    int* lens = malloc(rows * sizeof(int));
+    int* masked = malloc((size_t)max_batch * GENERATOR_MASKED * sizeof(int));
+    int* n_masked = malloc(max_batch * sizeof(int));
+    int* next = malloc(rows * sizeof(int));
+    int* target = malloc(rows * sizeof(int));
+    float* logits = malloc((size_t)SERVE_SCORE_ROWS * vocab_size * sizeof(float));
+    if (!active || !ctx || !lens || !masked || !n_masked || !next || !target || !logits) {
+        printf("Error: Could not allocate scheduler buffers\n");
+        exit(1);
+    }
+    int n_active = 0;
+
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (running && !queue_head && n_active == 0) pthread_cond_wait(&queue_cond, &queue_lock);
+        if (!running) break;
+
+        // Batching window: with nothing in flight, let more requests arrive
+        if (n_active == 0 && queue_len < max_batch) {
+            double deadline = queue_head->arrival + max_wait;
+            struct timespec ts;
+            ts.tv_sec = (time_t)deadline;
+            ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+            while (running && queue_len < max_batch &&
+                   pthread_cond_timedwait(&queue_cond, &queue_lock, &ts) != ETIMEDOUT);
+            if (!running) break;
+        }
+        while (queue_head && n_active < max_batch) {
+            active[n_active++] = queue_head;
+            queue_head = queue_head->next;
+            queue_len--;
+        }
+        if (!queue_head) queue_tail = NULL;
+        pthread_mutex_unlock(&queue_lock);
+
+        serve_pass(session, active, n_active, ctx, lens, masked, n_masked, next, target, logits);
+
+        pthread_mutex_lock(&queue_lock);
+        double now = now_seconds();
+        int kept = 0;
+        for (int i = 0; i < n_active; i++) {
+            serve_request* r = active[i];
+            if (r->type == REQUEST_GENERATE && r->gen.step < r->steps) active[kept++] = r;
+            else finish_request(r, now);
+        }
+        n_active = kept;
+    }
+
+    // Shutting down: release everyone still waiting
+    for (int i = 0; i < n_active; i++) finish_request(active[i], now_seconds());
+    for (serve_request* r = queue_head; r; r = queue_head) {
+        queue_head = r->next;
+        finish_request(r, now_seconds());
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    brook_session_free(session);
+    free(active);
+    free(ctx);
+    free(lens);
+    free(masked);
+    free(n_masked);
+    free(next);
+    free(target);
+    free(logits);
+    return NULL;
+}
+
+// Queues r and sleeps until the scheduler has finished it
+static void submit(serve_request* r) {
+    r->done = 0;
+    r->next = NULL;
+    pthread_mutex_lock(&queue_lock);
+    r->arrival = now_seconds();
+    if (first_arrival == 0.0) first_arrival = r->arrival;
+    if (queue_tail) queue_tail->next = r;
+    else queue_head = r;
+    queue_tail = r;
+    queue_len++;
+    pthread_cond_signal(&queue_cond);
+    while (!r->done) pthread_cond_wait(&r->cond, &queue_lock);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// Parses and runs one request line; writes the reply line to out.
+// Returns 0 when the client asked to close the connection.
+static int handle_line(serve_request* r, char* line, FILE* out) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, "quit") == 0) return 0;
+    if (strncmp(line, "generate ", 9) == 0) {
+        int steps = 0, used = 0;
+        if (sscanf(line + 9, "%d %n", &steps, &used) < 1 || steps < 1 || steps > SERVE_MAX_STEPS) {
+            fprintf(out, "error generate takes 1-%d steps\n", SERVE_MAX_STEPS);
+            return 1;
+        }
+        r->type = REQUEST_GENERATE;
+        r->steps = steps;
+        generator_begin(&r->gen, line + 9 + used, r->text, sizeof(r->text));
+        submit(r);
+        generator_finish(&r->gen);
+        fprintf(out, "ok %s\n", r->text);
+    } else if (strncmp(line, "score ", 6) == 0) {
+        to_lowercase(line + 6);
+        r->type = REQUEST_SCORE;
+        r->nll = 0.0;
+        tokenize_user_input(line + 6, r->score_tokens, &r->score_count, SERVE_MAX_SCORE);
+        if (r->score_count < 2) {
+            fprintf(out, "error score needs at least two known words\n");
+            return 1;
+        }
+        submit(r);
+        double mean = r->nll / (r->score_count - 1);
+        fprintf(out, "ok %d %.4f %.3f\n", r->score_count - 1, mean, exp(mean));
+    } else if (strcmp(line, "stats") == 0) {
+        long requests;
+        double p50, p99, rate, mean_batch;
+        pthread_mutex_lock(&queue_lock);
+        stats_snapshot(&requests, &p50, &p99, &rate, &mean_batch);
+        pthread_mutex_unlock(&queue_lock);
+        fprintf(out, "ok requests %ld p50_ms %.3f p99_ms %.3f tokens_per_sec %.0f mean_batch %.2f\n",
+                requests, p50, p99, rate, mean_batch);
+    } else {
+        fprintf(out, "error usage: generate STEPS SEED | score TEXT | stats | quit\n");
+    }
+    return 1;
+}
+
+static void* connection_main(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+    serve_request* r = calloc(1, sizeof(serve_request));
+    if (!in || !out || !r) {
+        if (in) fclose(in);
+        else close(fd);
+        if (out) fclose(out);
+        free(r);
+        return NULL;
+    }
+    pthread_cond_init(&r->cond, NULL);
+    char line[SERVE_LINE];
+    while (!stop_requested && fgets(line, sizeof(line), in)) {
+        if (!handle_line(r, line, out)) break;
+        if (fflush(out) != 0) break;
+    }
+    pthread_cond_destroy(&r->cond);
+    free(r);
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+// Fills a Unix or localhost TCP address; a number is a TCP port
+static socklen_t serve_address(const char* address, struct sockaddr_storage* sa) {
+    memset(sa, 0, sizeof(*sa));
+    if (address[0] && strspn(address, "0123456789") == strlen(address)) {
+        struct sockaddr_in* in = (struct sockaddr_in*)sa;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((unsigned short)atoi(address));
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(*in);
+    }
+    struct sockaddr_un* un = (struct sockaddr_un*)sa;
+    if (strlen(address) >= sizeof(un->sun_path)) return 0;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, address);
+    return sizeof(*un);
+}
+
+/**
+ * Connects to a server address as "brook serve" takes it. Returns the
+ * socket, or -1 with a message on failure.
+ */
+int serve_connect(const char* address) {
+    struct sockaddr_storage sa;
+    socklen_t len = serve_address(address, &sa);
+    int fd = len ? socket(sa.ss_family, SOCK_STREAM, 0) : -1;
+    if (fd < 0 || connect(fd, (struct sockaddr*)&sa, len) != 0) {
+        printf("Error: Could not connect to %s\n", address);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (sa.ss_family == AF_INET) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int serve_listen(const char* address) {
+    struct sockaddr_storage sa;
+    socklen_t len = serve_address(address, &sa);
+    int fd = len ? socket(sa.ss_family, SOCK_STREAM, 0) : -1;
+    if (fd < 0) {
+        printf("Error: Invalid server address %s\n", address);
+        return -1;
+    }
+    if (sa.ss_family == AF_UNIX) {
+        unlink(address);
+    } else {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(fd, (struct sockaddr*)&sa, len) != 0 || listen(fd, SERVE_BACKLOG) != 0) {
+        printf("Error: Could not listen on %s: %s\n", address, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+    if (listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+}
+
+/**
+ * Runs the server until SIGINT/SIGTERM, then prints the request stats.
+ * args: [ADDRESS] [MAX_BATCH] [MAX_WAIT_MS]. Returns 0 on a clean stop.
+ */
+int serve_main(int argc, char* argv[]) {
+    const char* address = argc > 0 ? argv[0] : SERVE_DEFAULT_ADDRESS;
+    if (argc > 1) max_batch = atoi(argv[1]);
+    if (argc > 2) max_wait = atof(argv[2]) * 1e-3;
+    if (max_batch < 1 || max_batch > SERVE_MAX_BATCH || max_wait < 0.0) {
+        printf("Usage: brook serve [ADDRESS] [MAX_BATCH 1-%d] [MAX_WAIT_MS]\n", SERVE_MAX_BATCH);
+        return 1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    listen_fd = serve_listen(address);
+    if (listen_fd < 0) return 1;
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pthread_t scheduler;
+    pthread_create(&scheduler, NULL, scheduler_main, NULL);
+    printf("Serving on %s (max batch %d, max wait %.1fms)\n", address, max_batch, max_wait * 1e3);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_main, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    running = 0;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(scheduler, NULL);
+    close(listen_fd);
+    if (strspn(address, "0123456789") != strlen(address)) unlink(address);
+
+    long requests;
+    double p50, p99, rate, mean_batch;
+    pthread_mutex_lock(&queue_lock);
+    stats_snapshot(&requests, &p50, &p99, &rate, &mean_batch);
+    pthread_mutex_unlock(&queue_lock);
+    printf("Served %ld requests: latency p50 %.2fms, p99 %.2fms; %.0f tokens/s; %.2f requests per pass\n",
+           requests, p50, p99, rate, mean_batch);
+    return 0;
+}
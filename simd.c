@@ -0,0 +1,800 @@
+// Runtime-dispatched SIMD kernels.
+// Each instruction set gets its own copy of the hot vector kernels, compiled
+// with a per-function target attribute, so one portable binary runs the
+// AVX-512 kernels on AVX-512 hosts, AVX2+FMA on AVX2 hosts, and the scalar
+// loops everywhere else. The table is chosen once at startup via CPUID
+// (__builtin_cpu_supports); BROOK_SIMD=scalar|avx2|avx512 overrides it.
+#include "brook.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+// ---- Scalar kernels (portable fallback) ----
+
+static float scalar_dot(const float * restrict a, const float * restrict b, int n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 3 < n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Assumes row-major W[rows][cols]
+static void scalar_matvec(const float * restrict W, const float * restrict x,
+                          float * restrict out, int rows, int cols)
+{
+    for (int i = 0; i < rows; i++) {
+        out[i] = scalar_dot(&W[(size_t)i * cols], x, cols);
+    }
+}
+
+// C[i][j] = A[i] . B[j] for an M x N block of C with row stride ldc
+static void scalar_gemm_nt(const float * restrict A, const float * restrict B,
+                           float * restrict C, int M, int N, int K, int ldc)
+{
+    for (int i = 0; i < M; i++) {
+        scalar_matvec(B, &A[(size_t)i * K], &C[(size_t)i * ldc], N, K);
+    }
+}
+
+static void scalar_axpy(float alpha, const float * restrict x, float * restrict y, int n)
+{
+    for (int i = 0; i < n; i++) y[i] += alpha * x[i];
+}
+
+static float scalar_max(const float* x, int n)
+{
+    float m = x[0];
+    for (int i = 1; i < n; i++) if (x[i] > m) m = x[i];
+    return m;
+}
+
+static float scalar_exp_sum(float* x, int n, float shift)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        x[i] = expf(x[i] - shift);
+        sum += x[i];
+    }
+    return sum;
+}
+
+static void scalar_scale(float* x, int n, float s)
+{
+    for (int i = 0; i < n; i++) x[i] *= s;
+}
+
+static int scalar_dot_i8(const int8_t * restrict a, const int8_t * restrict b, int n)
+{
+    int s = 0;
+    for (int i = 0; i < n; i++) s += (int)a[i] * (int)b[i];
+    return s;
+}
+
+static void scalar_matvec_bf16(const bf16 * restrict W, const float * restrict x,
+                               float * restrict out, int rows, int cols)
+{
+    for (int i = 0; i < rows; i++) {
+        const bf16* row = &W[(size_t)i * cols];
+        float s = 0.0f;
+        for (int j = 0; j < cols; j++) s += bf16_to_float(row[j]) * x[j];
+        out[i] = s;
+    }
+}
+
+static void scalar_axpy_bf16(float alpha, const bf16 * restrict x, float * restrict y, int n)
+{
+    for (int i = 0; i < n; i++) y[i] += alpha * bf16_to_float(x[i]);
+}
+
+// Fused Adam/AdamW step: clip, both moment updates and the weight update
+// in one pass, so each of w, g, m and v is streamed exactly once
+static void scalar_adam(float * restrict w, const float * restrict g, float * restrict m,
+                        float * restrict v, int n, const adam_params* p)
+{
+    for (int i = 0; i < n; i++) {
+        float grad = g[i];
+        if (grad > p->clip) grad = p->clip;
+        if (grad < -p->clip) grad = -p->clip;
+        m[i] = p->beta1 * m[i] + (1.0f - p->beta1) * grad;
+        v[i] = p->beta2 * v[i] + (1.0f - p->beta2) * grad * grad;
+        float step = (m[i] * p->bias1) / (sqrtf(v[i] * p->bias2) + p->eps);
+        w[i] -= p->lr * step + p->decay * w[i];
+    }
+}
+
+#ifdef SIMD_X86
+
+// ---- AVX2 + FMA kernels ----
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static inline float hsum256(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+// Aligned loads when every row start is on a vector boundary (SIMD_ALIGN
+// buffers whose row length is a multiple of the width), unaligned
+// otherwise; the kernels below are instantiated once for each case.
+#define ALIGNED(p, bytes) (((uintptr_t)(p) & ((bytes) - 1)) == 0)
+#define LOAD256(p, aligned) ((aligned) ? _mm256_load_ps(p) : _mm256_loadu_ps(p))
+#define STORE256(p, v, aligned) ((aligned) ? _mm256_store_ps(p, v) : _mm256_storeu_ps(p, v))
+#define INLINE inline __attribute__((always_inline))
+
+AVX2 static INLINE float avx2_dot_impl(const float * restrict a, const float * restrict b, int n,
+                                       const int aligned)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 15 < n; i += 16) {
+        acc0 = _mm256_fmadd_ps(LOAD256(a + i, aligned), LOAD256(b + i, aligned), acc0);
+        acc1 = _mm256_fmadd_ps(LOAD256(a + i + 8, aligned), LOAD256(b + i + 8, aligned), acc1);
+    }
+    for (; i + 7 < n; i += 8) {
+        acc0 = _mm256_fmadd_ps(LOAD256(a + i, aligned), LOAD256(b + i, aligned), acc0);
+    }
+    float s = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) s += a[i] * b[i];
+    return s;
+}
+
+AVX2 static float avx2_dot(const float * restrict a, const float * restrict b, int n)
+{
+    if (ALIGNED(a, 32) && ALIGNED(b, 32)) return avx2_dot_impl(a, b, n, 1);
+    return avx2_dot_impl(a, b, n, 0);
+}
+
+// Four rows per pass share every load of x; one accumulator per row
+AVX2 static INLINE void avx2_matvec_impl(const float * restrict W, const float * restrict x,
+                                         float * restrict out, int rows, int cols, const int aligned)
+{
+    int i = 0;
+    for (; i + 3 < rows; i += 4) {
+        const float *w0 = &W[(size_t)(i + 0) * cols];
+        const float *w1 = &W[(size_t)(i + 1) * cols];
+        const float *w2 = &W[(size_t)(i + 2) * cols];
+        const float *w3 = &W[(size_t)(i + 3) * cols];
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        int j = 0;
+        for (; j + 7 < cols; j += 8) {
+            __m256 xv = LOAD256(x + j, aligned);
+            a0 = _mm256_fmadd_ps(LOAD256(w0 + j, aligned), xv, a0);
+            a1 = _mm256_fmadd_ps(LOAD256(w1 + j, aligned), xv, a1);
+            a2 = _mm256_fmadd_ps(LOAD256(w2 + j, aligned), xv, a2);
+            a3 = _mm256_fmadd_ps(LOAD256(w3 + j, aligned), xv, a3);
+        }
+        float s0 = hsum256(a0), s1 = hsum256(a1), s2 = hsum256(a2), s3 = hsum256(a3);
+        for (; j < cols; j++) {
+            s0 += w0[j] * x[j];
+            s1 += w1[j] * x[j];
+            s2 += w2[j] * x[j];
+            s3 += w3[j] * x[j];
+        }
+        out[i] = s0;
+        out[i + 1] = s1;
+        out[i + 2] = s2;
+        out[i + 3] = s3;
+    }
+    for (; i < rows; i++) out[i] = avx2_dot_impl(&W[(size_t)i * cols], x, cols, aligned);
+}
+
+AVX2 static void avx2_matvec(const float * restrict W, const float * restrict x,
+                             float * restrict out, int rows, int cols)
+{
+    if (ALIGNED(W, 32) && ALIGNED(x, 32) && cols % 8 == 0) avx2_matvec_impl(W, x, out, rows, cols, 1);
+    else avx2_matvec_impl(W, x, out, rows, cols, 0);
+}
+
+AVX2 static INLINE void avx2_axpy_impl(float alpha, const float * restrict x, float * restrict y, int n,
+                                       const int aligned)
+{
+    __m256 av = _mm256_set1_ps(alpha);
+    int i = 0;
+    for (; i + 7 < n; i += 8) {
+        STORE256(y + i, _mm256_fmadd_ps(av, LOAD256(x + i, aligned), LOAD256(y + i, aligned)), aligned);
+    }
+    for (; i < n; i++) y[i] += alpha * x[i];
+}
+
+AVX2 static void avx2_axpy(float alpha, const float * restrict x, float * restrict y, int n)
+{
+    if (ALIGNED(x, 32) && ALIGNED(y, 32)) avx2_axpy_impl(alpha, x, y, n, 1);
+    else avx2_axpy_impl(alpha, x, y, n, 0);
+}
+
+// C[i][j] = A[i] . B[j] for an M x N block (row stride ldc). Four rows of
+// A against two rows of B per pass: eight accumulators, so every loaded
+// vector of A feeds two FMAs and every vector of B feeds four.
+AVX2 static INLINE void avx2_gemm_nt_impl(const float * restrict A, const float * restrict B,
+                                          float * restrict C, int M, int N, int K, int ldc,
+                                          const int aligned)
+{
+    int i = 0;
+    for (; i + 3 < M; i += 4) {
+        const float *a0 = &A[(size_t)i * K], *a1 = a0 + K, *a2 = a1 + K, *a3 = a2 + K;
+        float *c0 = &C[(size_t)i * ldc], *c1 = c0 + ldc, *c2 = c1 + ldc, *c3 = c2 + ldc;
+        int j = 0;
+        for (; j + 1 < N; j += 2) {
+            const float *b0 = &B[(size_t)j * K], *b1 = b0 + K;
+            __m256 s00 = _mm256_setzero_ps(), s01 = _mm256_setzero_ps();
+            __m256 s10 = _mm256_setzero_ps(), s11 = _mm256_setzero_ps();
+            __m256 s20 = _mm256_setzero_ps(), s21 = _mm256_setzero_ps();
+            __m256 s30 = _mm256_setzero_ps(), s31 = _mm256_setzero_ps();
+            int k = 0;
+            for (; k + 7 < K; k += 8) {
+                __m256 bv0 = LOAD256(b0 + k, aligned), bv1 = LOAD256(b1 + k, aligned);
+                __m256 av = LOAD256(a0 + k, aligned);
+                s00 = _mm256_fmadd_ps(av, bv0, s00);
+                s01 = _mm256_fmadd_ps(av, bv1, s01);
+                av = LOAD256(a1 + k, aligned);
+                s10 = _mm256_fmadd_ps(av, bv0, s10);
+                s11 = _mm256_fmadd_ps(av, bv1, s11);
+                av = LOAD256(a2 + k, aligned);
+                s20 = _mm256_fmadd_ps(av, bv0, s20);
+                s21 = _mm256_fmadd_ps(av, bv1, s21);
+                av = LOAD256(a3 + k, aligned);
+                s30 = _mm256_fmadd_ps(av, bv0, s30);
+                s31 = _mm256_fmadd_ps(av, bv1, s31);
+            }
+            float r00 = hsum256(s00), r01 = hsum256(s01), r10 = hsum256(s10), r11 = hsum256(s11);
+            float r20 = hsum256(s20), r21 = hsum256(s21), r30 = hsum256(s30), r31 = hsum256(s31);
+            for (; k < K; k++) {
+                r00 += a0[k] * b0[k]; r01 += a0[k] * b1[k];
+                r10 += a1[k] * b0[k]; r11 += a1[k] * b1[k];
+                r20 += a2[k] * b0[k]; r21 += a2[k] * b1[k];
+                r30 += a3[k] * b0[k]; r31 += a3[k] * b1[k];
+            }
+            c0[j] = r00; c0[j + 1] = r01;
+            c1[j] = r10; c1[j + 1] = r11;
+            c2[j] = r20; c2[j + 1] = r21;
+            c3[j] = r30; c3[j + 1] = r31;
+        }
+        if (j < N) {
+            const float *b0 = &B[(size_t)j * K];
+            c0[j] = avx2_dot_impl(a0, b0, K, aligned);
+            c1[j] = avx2_dot_impl(a1, b0, K, aligned);
+            c2[j] = avx2_dot_impl(a2, b0, K, aligned);
+            c3[j] = avx2_dot_impl(a3, b0, K, aligned);
+        }
+    }
+    for (; i < M; i++) avx2_matvec_impl(B, &A[(size_t)i * K], &C[(size_t)i * ldc], N, K, aligned);
+}
+
+AVX2 static void avx2_gemm_nt(const float * restrict A, const float * restrict B,
+                              float * restrict C, int M, int N, int K, int ldc)
+{
+    if (ALIGNED(A, 32) && ALIGNED(B, 32) && K % 8 == 0) avx2_gemm_nt_impl(A, B, C, M, N, K, ldc, 1);
+    else avx2_gemm_nt_impl(A, B, C, M, N, K, ldc, 0);
+}
+
+AVX2 static float avx2_max(const float* x, int n)
+{
+    if (n < 8) return scalar_max(x, n);
+    __m256 m = _mm256_loadu_ps(x);
+    int i = 8;
+    for (; i + 7 < n; i += 8) m = _mm256_max_ps(m, _mm256_loadu_ps(x + i));
+    __m128 lo = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+    lo = _mm_max_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_max_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    float r = _mm_cvtss_f32(lo);
+    for (; i < n; i++) if (x[i] > r) r = x[i];
+    return r;
+}
+
+// Cephes-style expf: range reduction by ln2, degree-5 polynomial, then
+// scale by 2^n built directly in the exponent bits
+AVX2 static inline __m256 exp256(__m256 x)
+{
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+    __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+    fx = _mm256_floor_ps(fx);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_fmadd_ps(y, z, x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+    __m256i n = _mm256_cvttps_epi32(fx);
+    n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+AVX2 static float avx2_exp_sum(float* x, int n, float shift)
+{
+    __m256 sv = _mm256_set1_ps(shift);
+    __m256 acc = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 7 < n; i += 8) {
+        __m256 e = exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i), sv));
+        _mm256_storeu_ps(x + i, e);
+        acc = _mm256_add_ps(acc, e);
+    }
+    float sum = hsum256(acc);
+    for (; i < n; i++) {
+        x[i] = expf(x[i] - shift);
+        sum += x[i];
+    }
+    return sum;
+}
+
+AVX2 static void avx2_scale(float* x, int n, float s)
+{
+    __m256 sv = _mm256_set1_ps(s);
+    int i = 0;
+    for (; i + 7 < n; i += 8) _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), sv));
+    for (; i < n; i++) x[i] *= s;
+}
+
+// int8 x int8 -> int32: widen 16 lanes to int16, then madd pairs into int32
+AVX2 static int avx2_dot_i8(const int8_t * restrict a, const int8_t * restrict b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 15 < n; i += 16) {
+        __m256i av = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i bv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(av, bv));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    int r = _mm_cvtsi128_si32(s);
+    for (; i < n; i++) r += (int)a[i] * (int)b[i];
+    return r;
+}
+
+// Widens 8 bf16 values to fp32 by shifting them into the high half
+AVX2 static inline __m256 load_bf16x8(const bf16* p)
+{
+    __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(v, 16));
+}
+
+AVX2 static void avx2_matvec_bf16(const bf16 * restrict W, const float * restrict x,
+                                  float * restrict out, int rows, int cols)
+{
+    int i = 0;
+    for (; i + 3 < rows; i += 4) {
+        const bf16 *w0 = &W[(size_t)(i + 0) * cols];
+        const bf16 *w1 = &W[(size_t)(i + 1) * cols];
+        const bf16 *w2 = &W[(size_t)(i + 2) * cols];
+        const bf16 *w3 = &W[(size_t)(i + 3) * cols];
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        int j = 0;
+        for (; j + 7 < cols; j += 8) {
+            __m256 xv = _mm256_loadu_ps(x + j);
+            a0 = _mm256_fmadd_ps(load_bf16x8(w0 + j), xv, a0);
+            a1 = _mm256_fmadd_ps(load_bf16x8(w1 + j), xv, a1);
+            a2 = _mm256_fmadd_ps(load_bf16x8(w2 + j), xv, a2);
+            a3 = _mm256_fmadd_ps(load_bf16x8(w3 + j), xv, a3);
+        }
+        float s0 = hsum256(a0), s1 = hsum256(a1), s2 = hsum256(a2), s3 = hsum256(a3);
+        for (; j < cols; j++) {
+            s0 += bf16_to_float(w0[j]) * x[j];
+            s1 += bf16_to_float(w1[j]) * x[j];
+            s2 += bf16_to_float(w2[j]) * x[j];
+            s3 += bf16_to_float(w3[j]) * x[j];
+        }
+        out[i] = s0;
+        out[i + 1] = s1;
+        out[i + 2] = s2;
+        out[i + 3] = s3;
+    }
+    if (i < rows) scalar_matvec_bf16(&W[(size_t)i * cols], x, &out[i], rows - i, cols);
+}
+
+AVX2 static void avx2_axpy_bf16(float alpha, const bf16 * restrict x, float * restrict y, int n)
+{
+    __m256 av = _mm256_set1_ps(alpha);
+    int i = 0;
+    for (; i + 7 < n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(av, load_bf16x8(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; i++) y[i] += alpha * bf16_to_float(x[i]);
+}
+
+AVX2 static void avx2_adam(float * restrict w, const float * restrict g, float * restrict m,
+                           float * restrict v, int n, const adam_params* p)
+{
+    __m256 hi = _mm256_set1_ps(p->clip), lo = _mm256_set1_ps(-p->clip);
+    __m256 b1 = _mm256_set1_ps(p->beta1), nb1 = _mm256_set1_ps(1.0f - p->beta1);
+    __m256 b2 = _mm256_set1_ps(p->beta2), nb2 = _mm256_set1_ps(1.0f - p->beta2);
+    __m256 c1 = _mm256_set1_ps(p->bias1), c2 = _mm256_set1_ps(p->bias2);
+    __m256 eps = _mm256_set1_ps(p->eps), lr = _mm256_set1_ps(p->lr);
+    __m256 decay = _mm256_set1_ps(p->decay);
+    int i = 0;
+    for (; i + 7 < n; i += 8) {
+        __m256 gv = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(g + i), lo), hi);
+        __m256 mv = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), _mm256_mul_ps(nb1, gv));
+        __m256 vv = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), _mm256_mul_ps(nb2, _mm256_mul_ps(gv, gv)));
+        _mm256_storeu_ps(m + i, mv);
+        _mm256_storeu_ps(v + i, vv);
+        __m256 denom = _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(vv, c2)), eps);
+        __m256 step = _mm256_div_ps(_mm256_mul_ps(mv, c1), denom);
+        __m256 wv = _mm256_loadu_ps(w + i);
+        wv = _mm256_fnmadd_ps(decay, wv, _mm256_fnmadd_ps(lr, step, wv));
+        _mm256_storeu_ps(w + i, wv);
+    }
+    if (i < n) scalar_adam(w + i, g + i, m + i, v + i, n - i, p);
+}
+
+// ---- AVX-512 kernels (tails handled with masked loads) ----
+
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static inline __mmask16 tail_mask(int remaining)
+{
+    return (__mmask16)((1u << remaining) - 1u);
+}
+
+#define LOAD512(p, aligned) ((aligned) ? _mm512_load_ps(p) : _mm512_loadu_ps(p))
+#define STORE512(p, v, aligned) ((aligned) ? _mm512_store_ps(p, v) : _mm512_storeu_ps(p, v))
+
+AVX512 static INLINE float avx512_dot_impl(const float * restrict a, const float * restrict b, int n,
+                                           const int aligned)
+{
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 31 < n; i += 32) {
+        acc0 = _mm512_fmadd_ps(LOAD512(a + i, aligned), LOAD512(b + i, aligned), acc0);
+        acc1 = _mm512_fmadd_ps(LOAD512(a + i + 16, aligned), LOAD512(b + i + 16, aligned), acc1);
+    }
+    for (; i + 15 < n; i += 16) {
+        acc0 = _mm512_fmadd_ps(LOAD512(a + i, aligned), LOAD512(b + i, aligned), acc0);
+    }
+    if (i < n) {
+        __mmask16 m = tail_mask(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+AVX512 static float avx512_dot(const float * restrict a, const float * restrict b, int n)
+{
+    if (ALIGNED(a, 64) && ALIGNED(b, 64)) return avx512_dot_impl(a, b, n, 1);
+    return avx512_dot_impl(a, b, n, 0);
+}
+
+AVX512 static INLINE void avx512_matvec_impl(const float * restrict W, const float * restrict x,
+                                             float * restrict out, int rows, int cols, const int aligned)
+{
+    int i = 0;
+    for (; i + 3 < rows; i += 4) {
+        const float *w0 = &W[(size_t)(i + 0) * cols];
+        const float *w1 = &W[(size_t)(i + 1) * cols];
+        const float *w2 = &W[(size_t)(i + 2) * cols];
+        const float *w3 = &W[(size_t)(i + 3) * cols];
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+        __m512 a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        int j = 0;
+        for (; j + 15 < cols; j += 16) {
+            __m512 xv = LOAD512(x + j, aligned);
+            a0 = _mm512_fmadd_ps(LOAD512(w0 + j, aligned), xv, a0);
+            a1 = _mm512_fmadd_ps(LOAD512(w1 + j, aligned), xv, a1);
+            a2 = _mm512_fmadd_ps(LOAD512(w2 + j, aligned), xv, a2);
+            a3 = _mm512_fmadd_ps(LOAD512(w3 + j, aligned), xv, a3);
+        }
+        if (j < cols) {
+            __mmask16 m = tail_mask(cols - j);
+            __m512 xv = _mm512_maskz_loadu_ps(m, x + j);
+            a0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w0 + j), xv, a0);
+            a1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w1 + j), xv, a1);
+            a2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w2 + j), xv, a2);
+            a3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w3 + j), xv, a3);
+        }
+        out[i] = _mm512_reduce_add_ps(a0);
+        out[i + 1] = _mm512_reduce_add_ps(a1);
+        out[i + 2] = _mm512_reduce_add_ps(a2);
+        out[i + 3] = _mm512_reduce_add_ps(a3);
+    }
+    for (; i < rows; i++) out[i] = avx512_dot_impl(&W[(size_t)i * cols], x, cols, aligned);
+}
+
+AVX512 static void avx512_matvec(const float * restrict W, const float * restrict x,
+                                 float * restrict out, int rows, int cols)
+{
+    if (ALIGNED(W, 64) && ALIGNED(x, 64) && cols % 16 == 0) avx512_matvec_impl(W, x, out, rows, cols, 1);
+    else avx512_matvec_impl(W, x, out, rows, cols, 0);
+}
+
+AVX512 static INLINE void avx512_axpy_impl(float alpha, const float * restrict x, float * restrict y, int n,
+                                           const int aligned)
+{
+    __m512 av = _mm512_set1_ps(alpha);
+    int i = 0;
+    for (; i + 15 < n; i += 16) {
+        STORE512(y + i, _mm512_fmadd_ps(av, LOAD512(x + i, aligned), LOAD512(y + i, aligned)), aligned);
+    }
+    if (i < n) {
+        __mmask16 m = tail_mask(n - i);
+        __m512 r = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+        _mm512_mask_storeu_ps(y + i, m, r);
+    }
+}
+
+AVX512 static void avx512_axpy(float alpha, const float * restrict x, float * restrict y, int n)
+{
+    if (ALIGNED(x, 64) && ALIGNED(y, 64)) avx512_axpy_impl(alpha, x, y, n, 1);
+    else avx512_axpy_impl(alpha, x, y, n, 0);
+}
+
+// The AVX2 blocking widened: four rows of A against four rows of B, 16
+// accumulators out of 32 registers, masked loads for the K tail
+AVX512 static INLINE void avx512_gemm_nt_impl(const float * restrict A, const float * restrict B,
+                                              float * restrict C, int M, int N, int K, int ldc,
+                                              const int aligned)
+{
+    int i = 0;
+    for (; i + 3 < M; i += 4) {
+        const float *a[4] = { &A[(size_t)i * K], &A[(size_t)(i + 1) * K],
+                              &A[(size_t)(i + 2) * K], &A[(size_t)(i + 3) * K] };
+        int j = 0;
+        for (; j + 3 < N; j += 4) {
+            const float *b[4] = { &B[(size_t)j * K], &B[(size_t)(j + 1) * K],
+                                  &B[(size_t)(j + 2) * K], &B[(size_t)(j + 3) * K] };
+            __m512 s[4][4];
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++) s[r][c] = _mm512_setzero_ps();
+            int k = 0;
+            for (; k + 15 < K; k += 16) {
+                __m512 bv[4];
+                for (int c = 0; c < 4; c++) bv[c] = LOAD512(b[c] + k, aligned);
+                for (int r = 0; r < 4; r++) {
+                    __m512 av = LOAD512(a[r] + k, aligned);
+                    for (int c = 0; c < 4; c++) s[r][c] = _mm512_fmadd_ps(av, bv[c], s[r][c]);
+                }
+            }
+            if (k < K) {
+                __mmask16 m = tail_mask(K - k);
+                __m512 bv[4];
+                for (int c = 0; c < 4; c++) bv[c] = _mm512_maskz_loadu_ps(m, b[c] + k);
+                for (int r = 0; r < 4; r++) {
+                    __m512 av = _mm512_maskz_loadu_ps(m, a[r] + k);
+                    for (int c = 0; c < 4; c++) s[r][c] = _mm512_fmadd_ps(av, bv[c], s[r][c]);
+                }
+            }
+            for (int r = 0; r < 4; r++)
+                for (int c = 0; c < 4; c++) C[(size_t)(i + r) * ldc + j + c] = _mm512_reduce_add_ps(s[r][c]);
+        }
+        for (; j < N; j++)
+            for (int r = 0; r < 4; r++) C[(size_t)(i + r) * ldc + j] = avx512_dot_impl(a[r], &B[(size_t)j * K], K, aligned);
+    }
+    for (; i < M; i++) avx512_matvec_impl(B, &A[(size_t)i * K], &C[(size_t)i * ldc], N, K, aligned);
+}
+
+AVX512 static void avx512_gemm_nt(const float * restrict A, const float * restrict B,
+                                  float * restrict C, int M, int N, int K, int ldc)
+{
+    if (ALIGNED(A, 64) && ALIGNED(B, 64) && K % 16 == 0) avx512_gemm_nt_impl(A, B, C, M, N, K, ldc, 1);
+    else avx512_gemm_nt_impl(A, B, C, M, N, K, ldc, 0);
+}
+
+AVX512 static float avx512_max(const float* x, int n)
+{
+    if (n < 16) return scalar_max(x, n);
+    __m512 m = _mm512_loadu_ps(x);
+    int i = 16;
+    for (; i + 15 < n; i += 16) m = _mm512_max_ps(m, _mm512_loadu_ps(x + i));
+    float r = _mm512_reduce_max_ps(m);
+    for (; i < n; i++) if (x[i] > r) r = x[i];
+    return r;
+}
+
+AVX512 static inline __m512 exp512(__m512 x)
+{
+    x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+    x = _mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f));
+    __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f));
+    fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(0.693359375f), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(-2.12194440e-4f), x);
+    __m512 z = _mm512_mul_ps(x, x);
+    __m512 y = _mm512_set1_ps(1.9875691500e-4f);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.3981999507e-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(8.3334519073e-3f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(4.1665795894e-2f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.6666665459e-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(5.0000001201e-1f));
+    y = _mm512_fmadd_ps(y, z, x);
+    y = _mm512_add_ps(y, _mm512_set1_ps(1.0f));
+    __m512i n = _mm512_cvttps_epi32(fx);
+    n = _mm512_slli_epi32(_mm512_add_epi32(n, _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(y, _mm512_castsi512_ps(n));
+}
+
+AVX512 static float avx512_exp_sum(float* x, int n, float shift)
+{
+    __m512 sv = _mm512_set1_ps(shift);
+    __m512 acc = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 15 < n; i += 16) {
+        __m512 e = exp512(_mm512_sub_ps(_mm512_loadu_ps(x + i), sv));
+        _mm512_storeu_ps(x + i, e);
+        acc = _mm512_add_ps(acc, e);
+    }
+    if (i < n) {
+        __mmask16 m = tail_mask(n - i);
+        __m512 e = exp512(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + i), sv));
+        _mm512_mask_storeu_ps(x + i, m, e);
+        acc = _mm512_mask_add_ps(acc, m, acc, e);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static void avx512_scale(float* x, int n, float s)
+{
+    __m512 sv = _mm512_set1_ps(s);
+    int i = 0;
+    for (; i + 15 < n; i += 16) _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), sv));
+    if (i < n) {
+        __mmask16 m = tail_mask(n - i);
+        _mm512_mask_storeu_ps(x + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i), sv));
+    }
+}
+
+AVX512 static void avx512_adam(float * restrict w, const float * restrict g, float * restrict m,
+                               float * restrict v, int n, const adam_params* p)
+{
+    __m512 hi = _mm512_set1_ps(p->clip), lo = _mm512_set1_ps(-p->clip);
+    __m512 b1 = _mm512_set1_ps(p->beta1), nb1 = _mm512_set1_ps(1.0f - p->beta1);
+    __m512 b2 = _mm512_set1_ps(p->beta2), nb2 = _mm512_set1_ps(1.0f - p->beta2);
+    __m512 c1 = _mm512_set1_ps(p->bias1), c2 = _mm512_set1_ps(p->bias2);
+    __m512 eps = _mm512_set1_ps(p->eps), lr = _mm512_set1_ps(p->lr);
+    __m512 decay = _mm512_set1_ps(p->decay);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 k = (n - i >= 16) ? (__mmask16)0xFFFF : tail_mask(n - i);
+        __m512 gv = _mm512_min_ps(_mm512_max_ps(_mm512_maskz_loadu_ps(k, g + i), lo), hi);
+        __m512 mv = _mm512_fmadd_ps(b1, _mm512_maskz_loadu_ps(k, m + i), _mm512_mul_ps(nb1, gv));
+        __m512 vv = _mm512_fmadd_ps(b2, _mm512_maskz_loadu_ps(k, v + i), _mm512_mul_ps(nb2, _mm512_mul_ps(gv, gv)));
+        _mm512_mask_storeu_ps(m + i, k, mv);
+        _mm512_mask_storeu_ps(v + i, k, vv);
+        __m512 denom = _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(vv, c2)), eps);
+        __m512 step = _mm512_div_ps(_mm512_mul_ps(mv, c1), denom);
+        __m512 wv = _mm512_maskz_loadu_ps(k, w + i);
+        wv = _mm512_fnmadd_ps(decay, wv, _mm512_fnmadd_ps(lr, step, wv));
+        _mm512_mask_storeu_ps(w + i, k, wv);
+    }
+}
+
+// Widens up to 16 bf16 values; 16-bit masked loads need AVX512BW, so a
+// short tail is staged through a zeroed buffer instead
+AVX512 static inline __m512 load_bf16x16(const bf16* p, int n)
+{
+    __m256i raw;
+    if (n >= 16) {
+        raw = _mm256_loadu_si256((const __m256i*)p);
+    } else {
+        bf16 tmp[16] = {0};
+        memcpy(tmp, p, n * sizeof(bf16));
+        raw = _mm256_loadu_si256((const __m256i*)tmp);
+    }
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(raw), 16));
+}
+
+AVX512 static void avx512_matvec_bf16(const bf16 * restrict W, const float * restrict x,
+                                      float * restrict out, int rows, int cols)
+{
+    int i = 0;
+    for (; i + 3 < rows; i += 4) {
+        const bf16 *w0 = &W[(size_t)(i + 0) * cols];
+        const bf16 *w1 = &W[(size_t)(i + 1) * cols];
+        const bf16 *w2 = &W[(size_t)(i + 2) * cols];
+        const bf16 *w3 = &W[(size_t)(i + 3) * cols];
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+        __m512 a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        for (int j = 0; j < cols; j += 16) {
+            int left = cols - j;
+            __mmask16 k = (left >= 16) ? (__mmask16)0xFFFF : tail_mask(left);
+            __m512 xv = _mm512_maskz_loadu_ps(k, x + j);
+            a0 = _mm512_fmadd_ps(load_bf16x16(w0 + j, left), xv, a0);
+            a1 = _mm512_fmadd_ps(load_bf16x16(w1 + j, left), xv, a1);
+            a2 = _mm512_fmadd_ps(load_bf16x16(w2 + j, left), xv, a2);
+            a3 = _mm512_fmadd_ps(load_bf16x16(w3 + j, left), xv, a3);
+        }
+        out[i] = _mm512_reduce_add_ps(a0);
+        out[i + 1] = _mm512_reduce_add_ps(a1);
+        out[i + 2] = _mm512_reduce_add_ps(a2);
+        out[i + 3] = _mm512_reduce_add_ps(a3);
+    }
+    for (; i < rows; i++) {
+        const bf16* row = &W[(size_t)i * cols];
+        __m512 acc = _mm512_setzero_ps();
+        for (int j = 0; j < cols; j += 16) {
+            __mmask16 k = (cols - j >= 16) ? (__mmask16)0xFFFF : tail_mask(cols - j);
+            acc = _mm512_fmadd_ps(load_bf16x16(row + j, cols - j), _mm512_maskz_loadu_ps(k, x + j), acc);
+        }
+        out[i] = _mm512_reduce_add_ps(acc);
+    }
+}
+
+AVX512 static void avx512_axpy_bf16(float alpha, const bf16 * restrict x, float * restrict y, int n)
+{
+    __m512 av = _mm512_set1_ps(alpha);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 k = (n - i >= 16) ? (__mmask16)0xFFFF : tail_mask(n - i);
+        __m512 r = _mm512_fmadd_ps(av, load_bf16x16(x + i, n - i), _mm512_maskz_loadu_ps(k, y + i));
+        _mm512_mask_storeu_ps(y + i, k, r);
+    }
+}
+
+#endif // SIMD_X86
+
+// ---- Dispatch ----
+
+static const simd_kernels scalar_kernels = {
+    "scalar", scalar_dot, scalar_matvec, scalar_axpy, scalar_max, scalar_exp_sum, scalar_scale,
+    scalar_adam, scalar_dot_i8, scalar_matvec_bf16, scalar_axpy_bf16, scalar_gemm_nt
+};
+#ifdef SIMD_X86
+static const simd_kernels avx2_kernels = {
+    "avx2", avx2_dot, avx2_matvec, avx2_axpy, avx2_max, avx2_exp_sum, avx2_scale,
+    avx2_adam, avx2_dot_i8, avx2_matvec_bf16, avx2_axpy_bf16, avx2_gemm_nt
+};
+static const simd_kernels avx512_kernels = {
+    "avx512", avx512_dot, avx512_matvec, avx512_axpy, avx512_max, avx512_exp_sum, avx512_scale,
+    avx512_adam, avx2_dot_i8,  // 512-bit int16 madd needs AVX512BW
+    avx512_matvec_bf16, avx512_axpy_bf16, avx512_gemm_nt
+};
+#endif
+
+const simd_kernels* simd = &scalar_kernels;
+
+static int has_avx2 = 0, has_avx512 = 0;
+
+// Switches to the named kernel set ("scalar", "avx2", "avx512").
+// Returns 0, leaving the current set, if the CPU doesn't support it.
+int simd_select(const char* name)
+{
+    if (strcmp(name, "scalar") == 0) {
+        simd = &scalar_kernels;
+        return 1;
+    }
+#ifdef SIMD_X86
+    if (strcmp(name, "avx2") == 0 && has_avx2) {
+        simd = &avx2_kernels;
+        return 1;
+    }
+    if (strcmp(name, "avx512") == 0 && has_avx512) {
+        simd = &avx512_kernels;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Picks the widest kernel set the CPU supports. Runs before main().
+__attribute__((constructor)) void simd_init()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    has_avx512 = has_avx2 && __builtin_cpu_supports("avx512f");
+#endif
+    if (!simd_select("avx512") && !simd_select("avx2")) simd_select("scalar");
+
+    // Allow forcing a narrower (never an unsupported) kernel set
+    const char* force = getenv("BROOK_SIMD");
+    if (force) simd_select(force);
+}
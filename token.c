@@ -1,15 +1,62 @@
 #include "brook.h"
 
+// Open-addressing hash index over vocab[]: slot -> token id, -1 when empty.
+// Kept at a power of two comfortably above MAX_VOCAB so probes stay short.
+#define VOCAB_INDEX_SIZE 16384
+#define VOCAB_INDEX_MASK (VOCAB_INDEX_SIZE - 1)
+
+static int vocab_index[VOCAB_INDEX_SIZE];
+static int vocab_index_count = -1;  // vocab_size the index was built for
+
+static unsigned int hash_word(const char* word) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; word[i]; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Returns the slot holding word, or the empty slot where it would go.
+ */
+static int vocab_index_slot(const char* word) {
+    unsigned int slot = hash_word(word) & VOCAB_INDEX_MASK;
+    while (vocab_index[slot] != -1 && strcmp(vocab[vocab_index[slot]], word) != 0)
+        slot = (slot + 1) & VOCAB_INDEX_MASK;
+    return (int)slot;
+}
+
+/**
+ * Rebuilds the hash index from vocab[0..vocab_size).
+ * Must be called whenever vocab[] is replaced wholesale (e.g. load_vocab).
+ * Duplicate words keep their first id, matching the old linear scan.
+ */
+void vocab_index_rebuild() {
+    memset(vocab_index, -1, sizeof(vocab_index));
+    for (int i = 0; i < vocab_size; i++) {
+        int slot = vocab_index_slot(vocab[i]);
+        if (vocab_index[slot] == -1) vocab_index[slot] = i;
+    }
+    vocab_index_count = vocab_size;
+}
+
 /**
  * Looks up a word in the vocab, optionally adding it if not found.
  * Returns token id or -1 if not found (and add_new==0).
  */
 int get_token_id_common(const char* word, int add_new) {
-    for (size_t i = 0; i < vocab_size; i++)
-        if (strcmp(vocab[i], word) == 0) return i;
+    if (vocab_index_count != vocab_size) vocab_index_rebuild();
+    int slot = vocab_index_slot(word);
+    if (vocab_index[slot] != -1) return vocab_index[slot];
     if (add_new && vocab_size < MAX_VOCAB) {
         strncpy(vocab[vocab_size], word, MAX_VOCAB_WORD_LEN - 1);
         vocab[vocab_size][MAX_VOCAB_WORD_LEN - 1] = '\0';
+        // Index the stored (possibly truncated) spelling
+        slot = vocab_index_slot(vocab[vocab_size]);
+        if (vocab_index[slot] == -1) vocab_index[slot] = vocab_size;
+        vocab_index_count = vocab_size + 1;
         return vocab_size++;
     }
     if (add_new) {
@@ -33,8 +80,6 @@ static char normalize_char(char c) {
     return ' '; // treat all other as space
 }
 
-typedef int (*token_lookup_fn)(const char*);
-
 int token_lookup_add(const char* word) {
     return get_token_id_common(word, 1);
 }
@@ -42,50 +87,95 @@ int token_lookup_existing(const char* word) {
     return get_token_id_common(word, 0);
 }
 
+/**
+ * Feeds one raw character to a token reader.
+ * Writes up to two token ids (a completed word and/or a '.'/'|' marker)
+ * to ids and returns how many were written. Words that span calls are
+ * carried in the reader, so text may arrive in arbitrary chunks.
+ */
+static int token_reader_feed(token_reader* r, char c, token_lookup_fn lookup, int ids[2]) {
+    char norm = normalize_char(c);
+    int n = 0;
+
+    if (norm == ' ' || norm == '.' || norm == '|') {
+        if (r->len > 0) {
+            r->buf[r->len] = '\0';
+            int id = lookup(r->buf);
+            if (id != -1) ids[n++] = id;
+            r->len = 0;
+        }
+        if (norm == '.' || norm == '|') {
+            char marker[2] = { norm, '\0' };
+            int id = lookup(marker);
+            if (id != -1) ids[n++] = id;
+        }
+    } else {
+        if (r->len < MAX_VOCAB_WORD_LEN - 1)
+            r->buf[r->len++] = norm;
+    }
+    return n;
+}
+
+void token_reader_init(token_reader* r) {
+    r->len = 0;
+}
+
 /**
  * Generic tokenization function.
  * Normalizes input, splits into tokens, and looks up token ids.
  * If out_count is not NULL, sets the number of tokens found.
  */
-static void tokenize_generic(const char* text, int* out_tokens, int* out_count, int max_tokens, token_lookup_fn lookup) {
+void tokenize_generic(const char* text, int* out_tokens, int* out_count, int max_tokens, token_lookup_fn lookup) {
     int count = 0;
     size_t i = 0;
     size_t text_len = strlen(text);
-    char token_buf[MAX_VOCAB_WORD_LEN];
-    int token_len = 0;
+    token_reader reader;
+    int ids[2];
 
+    token_reader_init(&reader);
     while (i <= text_len && count < max_tokens) {
         char c = (i < text_len) ? text[i] : ' ';
-        char norm = normalize_char(c);
-
-        if (norm == ' ' || norm == '.' || norm == '|') {
-            if (token_len > 0) {
-                token_buf[token_len] = '\0';
-                int id = lookup(token_buf);
-                if (id != -1) out_tokens[count++] = id;
-                token_len = 0;
-            }
-            if ((norm == '.' || norm == '|') && count < max_tokens) {
-                token_buf[0] = norm;
-                token_buf[1] = '\0';
-                int id = lookup(token_buf);
-                if (id != -1) out_tokens[count++] = id;
-            }
-        } else {
-            if (token_len < MAX_VOCAB_WORD_LEN - 1)
-                token_buf[token_len++] = norm;
-        }
+        int n = token_reader_feed(&reader, c, lookup, ids);
+        for (int k = 0; k < n && count < max_tokens; k++)
+            out_tokens[count++] = ids[k];
         i++;
     }
     if (out_count) *out_count = count;
 }
 
+/**
+ * Tokenizes a chunk of a larger text, adding new words to vocab and
+ * appending ids to the global token store. A word cut by the chunk edge
+ * is completed by the next call or by tokenize_finish().
+ * Returns 0 if the token store could not grow.
+ */
+int tokenize_chunk(token_reader* r, const char* data, size_t len) {
+    int ids[2];
+    for (size_t i = 0; i < len; i++) {
+        int n = token_reader_feed(r, data[i], token_lookup_add, ids);
+        for (int k = 0; k < n; k++)
+            if (!tokens_push(ids[k])) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Flushes any word still pending in the reader.
+ */
+int tokenize_finish(token_reader* r) {
+    return tokenize_chunk(r, " ", 1);
+}
+
 /**
  * Tokenizes input text, adding new words to vocab.
- * Uses global tokens/token_count.
+ * Replaces the contents of the global token store.
  */
 void tokenize(const char* text) {
-    tokenize_generic(text, tokens, &token_count, MAX_TOKENS, token_lookup_add);
+    token_reader reader;
+    tokens_clear();
+    token_reader_init(&reader);
+    if (tokenize_chunk(&reader, text, strlen(text)))
+        tokenize_finish(&reader);
 }
 
 /**
@@ -94,7 +184,3 @@ void tokenize(const char* text) {
 void tokenize_user_input(const char* text, int* out_tokens, int* out_count, int max_tokens) {
     tokenize_generic(text, out_tokens, out_count, max_tokens, token_lookup_existing);
 }
-
-
-
-
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 // Function to perform He initialization for weights
 // This is a crucial step to prevent vanishing gradients with ReLU activations
@@ -13,56 +14,244 @@ void he_init(float* W, int fan_in, int fan_out) {
     // Fill the weight matrix with random values from a normal distribution
     // This is a simple approximation using a uniform distribution
     for (int i = 0; i < fan_in * fan_out; i++) {
-        W[i] = ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * std_dev;
+        W[i] = (init_random() * 2.0f - 1.0f) * std_dev;
     }
 }
 
 int first_time = 1;
-float **dW = NULL;
-float **h_activations = NULL;
-float *x_input_buffer;
-float* dW_output = NULL;
-float** deltas = NULL;
-float* output_deltas = NULL;
-float initial_lr = 0.0f;
+float initial_lr = 0.0f;         // schedule base; restored from weights.bin, 0 = take the optimizer's
 int effective_context = 0;
-int prev_size = MAX_EMBED;
-float* logits = NULL;
-float* h_prev = NULL;
-float* probs = NULL;
-int target = 0;
 float current_lr = 0;
+int epochs_trained = 0;          // across runs; restored from weights.bin
+uint64_t train_seed = 0;         // BROOK_SEED; 0 picks one from the clock
 int final_layer_size = 0;
+int batch_size = 1;
+int num_threads = 1;
+int softmax_mode = SOFTMAX_FULL;
+int num_negatives = DEFAULT_NEGATIVES;
+int precision_mode = PRECISION_FP32;
 
-void init_training(int max_context)
+// bf16 copies of W[] and W_output for mixed precision training. The fp32
+// arrays stay the master weights that gradients and updates use; these
+// are refreshed from them after every update. NULL in fp32 mode.
+static bf16* W_bf16[MAX_HIDDEN_LAYERS];
+static bf16* W_output_bf16 = NULL;
+
+// Unigram^0.75 noise distribution for sampled softmax, built from tokens[]
+int* unigram_table = NULL;      // UNIGRAM_TABLE_SIZE token ids
+float* unigram_logq = NULL;     // per token: log of its noise probability
+
+// Per-thread training state. Each worker owns its activations, deltas and
+// gradient accumulators so workers never write to shared memory while an
+// epoch is in flight. Worker 0's gradients hold the reduced sum that
+// update_weights() applies.
+typedef struct {
+	float** dW;
+	float* dW_output;
+	float** h_activations;
+	float* x_input_buffer;
+	float** deltas;
+	float* output_deltas;
+	float* logits;
+	float* probs;
+	int target;
+
+	// Mini-batch buffers (row-major, one row per sample in the batch)
+	float* x_batch;          // batch_size x MAX_EMBED
+	float** h_batch;         // per layer: batch_size x hidden_sizes[layer]
+	float** delta_batch;     // per layer: batch_size x hidden_sizes[layer]
+	float* logits_batch;     // batch_size x vocab_size, reused for probs and deltas
+	unsigned char* batch_valid;  // batch_size: 0 if the row's context has an invalid id
+
+	// Sampled/tree softmax buffers: the output rows one sample touches
+	// (target plus negatives, or the inner nodes on the target's tree path)
+	int* sample_ids;
+	float* sample_rows;      // gathered rows, max_sampled_rows() x hidden
+	float* sample_deltas;
+	float* dW_tree;          // hierarchical softmax inner-node gradients
+	uint64_t rng;            // dropout and negative sampling, reseeded every epoch
+
+	// Sparse embedding gradients. A sample only touches its context rows
+	// of embed, so d_embed rows are accumulated and cleared through the
+	// touched-row list instead of sweeping all vocab_size rows.
+	float* d_embed;          // vocab_size x MAX_EMBED, only touched rows nonzero
+	int* embed_touched;      // row ids with a nonzero gradient
+	unsigned char* embed_mark;  // per row: 1 if listed in embed_touched
+	int num_touched;
+	float* d_pos;            // MAX_CONTEXT x MAX_EMBED
+	float* dx;               // input gradient, MAX_EMBED
+	float* dx_batch;         // batch_size x MAX_EMBED
+	int sample_pos;          // first context token of the current sample/batch
+
+	int id;
+	int sample_start, sample_end;  // this worker's share of the epoch
+	float loss;
+} train_worker;
+
+train_worker* workers = NULL;
+int num_workers = 0;
+pthread_barrier_t reduce_barrier;
+
+/**
+ * The seed for weight initialization and the training PRNGs. Fixed by
+ * train_seed (BROOK_SEED) for reproducible runs, else drawn from the clock
+ * once.
+ */
+uint64_t training_seed()
+{
+	if (!train_seed) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		train_seed = rng_seed((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+	}
+	return train_seed;
+}
+
+static void init_worker(train_worker* w, int id)
 {
-    srand((unsigned int)time(NULL));
+	memset(w, 0, sizeof(*w));
+	w->id = id;
+	w->rng = rng_seed(training_seed() + id);   // run_epoch reseeds per epoch
 
     // Allocate memory for gradients.
-    dW = malloc(num_hidden_layers * sizeof(float*));
+    w->dW = malloc(num_hidden_layers * sizeof(float*));
     for (int i = 0; i < num_hidden_layers; i++) {
-        dW[i] = calloc(hidden_sizes[i] * ((i == 0) ? MAX_EMBED : hidden_sizes[i - 1]), sizeof(float));
+        w->dW[i] = calloc_aligned(hidden_sizes[i] * ((i == 0) ? MAX_EMBED : hidden_sizes[i - 1]), sizeof(float));
     }
 
-	dW_output = calloc(OUTPUT_SIZE * hidden_sizes[num_hidden_layers - 1], sizeof(float));
+	w->dW_output = calloc_aligned((size_t)vocab_size * hidden_sizes[num_hidden_layers - 1], sizeof(float));
 
     // Allocate memory for hidden layer activations.
-    h_activations = malloc(num_hidden_layers * sizeof(float*));
+    w->h_activations = malloc(num_hidden_layers * sizeof(float*));
     for (int i = 0; i < num_hidden_layers; i++) {
-        h_activations[i] = malloc(hidden_sizes[i] * sizeof(float));
+        w->h_activations[i] = alloc_aligned(hidden_sizes[i] * sizeof(float));
     }
-    x_input_buffer = malloc(MAX_EMBED * sizeof(float));
+    w->x_input_buffer = alloc_aligned(MAX_EMBED * sizeof(float));
     
     // A buffer to store the deltas (error signals) for each layer
-    deltas = malloc(num_hidden_layers * sizeof(float*));
+    w->deltas = malloc(num_hidden_layers * sizeof(float*));
     for (int i = 0; i < num_hidden_layers; i++) {
-        deltas[i] = malloc(hidden_sizes[i] * sizeof(float));
+        w->deltas[i] = alloc_aligned(hidden_sizes[i] * sizeof(float));
     }
-    output_deltas = malloc(OUTPUT_SIZE * sizeof(float));
+    w->output_deltas = alloc_aligned(vocab_size * sizeof(float));
+
+	w->d_embed = calloc_aligned((size_t)vocab_size * MAX_EMBED, sizeof(float));
+	w->embed_touched = malloc(vocab_size * sizeof(int));
+	w->embed_mark = calloc(vocab_size, 1);
+	w->d_pos = calloc_aligned(MAX_CONTEXT * MAX_EMBED, sizeof(float));
+	w->dx = alloc_aligned(MAX_EMBED * sizeof(float));
+
+	w->probs = alloc_aligned(vocab_size * sizeof(float));
+	w->logits = alloc_aligned(vocab_size * sizeof(float));
+
+	if (batch_size > 1) {
+		w->x_batch = alloc_aligned(batch_size * MAX_EMBED * sizeof(float));
+		w->h_batch = malloc(num_hidden_layers * sizeof(float*));
+		w->delta_batch = malloc(num_hidden_layers * sizeof(float*));
+		for (int i = 0; i < num_hidden_layers; i++) {
+			w->h_batch[i] = alloc_aligned(batch_size * hidden_sizes[i] * sizeof(float));
+			w->delta_batch[i] = alloc_aligned(batch_size * hidden_sizes[i] * sizeof(float));
+		}
+		w->logits_batch = alloc_aligned((size_t)batch_size * vocab_size * sizeof(float));
+		w->dx_batch = alloc_aligned(batch_size * MAX_EMBED * sizeof(float));
+		w->batch_valid = malloc(batch_size);
+	}
+
+	if (softmax_mode == SOFTMAX_TREE) {
+		w->dW_tree = calloc((size_t)(tree_vocab_size - 1) * tree_hidden_size, sizeof(float));
+	}
+	if (softmax_mode != SOFTMAX_FULL) {
+		int num_samples = (softmax_mode == SOFTMAX_SAMPLED) ? num_negatives + 1 : tree_max_depth;
+		w->sample_ids = malloc(num_samples * sizeof(int));
+		w->sample_rows = alloc_aligned(num_samples * hidden_sizes[num_hidden_layers - 1] * sizeof(float));
+		w->sample_deltas = malloc(num_samples * sizeof(float));
+	}
+}
+
+static void convert_bf16(const float* src, bf16* dst, size_t n)
+{
+	for (size_t k = 0; k < n; k++) dst[k] = float_to_bf16(src[k]);
+}
+
+// Rounds the fp32 master weights into the bf16 copies, allocating them
+// on first use
+static void sync_bf16_weights()
+{
+	for (int layer = 0; layer < num_hidden_layers; layer++) {
+		size_t len = (size_t)hidden_sizes[layer] * ((layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1]);
+		if (!W_bf16[layer]) W_bf16[layer] = malloc(len * sizeof(bf16));
+		convert_bf16(W[layer], W_bf16[layer], len);
+	}
+	size_t out_len = (size_t)vocab_size * hidden_sizes[num_hidden_layers - 1];
+	if (!W_output_bf16) W_output_bf16 = malloc(out_len * sizeof(bf16));
+	convert_bf16(W_output, W_output_bf16, out_len);
+}
+
+static void free_bf16_weights()
+{
+	for (int layer = 0; layer < MAX_HIDDEN_LAYERS; layer++) {
+		free(W_bf16[layer]);
+		W_bf16[layer] = NULL;
+	}
+	free(W_output_bf16);
+	W_output_bf16 = NULL;
+}
+
+// Builds the unigram^0.75 noise table used to draw negatives, word2vec
+// style: each token fills a share of the table proportional to its
+// smoothed frequency, so drawing is a single random index.
+static void build_unigram_table()
+{
+	double* weight = calloc(vocab_size, sizeof(double));
+	double total = 0.0;
+	for (int i = 0; i < token_count; i++) {
+		if (tokens[i] >= 0 && tokens[i] < vocab_size) weight[tokens[i]] += 1.0;
+	}
+	for (int v = 0; v < vocab_size; v++) {
+		weight[v] = pow(weight[v], 0.75);
+		total += weight[v];
+	}
+
+	unigram_table = malloc(UNIGRAM_TABLE_SIZE * sizeof(int));
+	unigram_logq = malloc(vocab_size * sizeof(float));
+	int v = 0;
+	double cumulative = weight[0] / total;
+	for (int i = 0; i < UNIGRAM_TABLE_SIZE; i++) {
+		unigram_table[i] = v;
+		if ((double)(i + 1) / UNIGRAM_TABLE_SIZE > cumulative && v < vocab_size - 1) {
+			v++;
+			cumulative += weight[v] / total;
+		}
+	}
+	for (int t = 0; t < vocab_size; t++) {
+		// Unseen tokens are never drawn; give them a tiny probability
+		float q = (float)(weight[t] / total);
+		unigram_logq[t] = logf(q > 1e-12f ? q : 1e-12f);
+	}
+	free(weight);
+}
 
-	probs = malloc(vocab_size * sizeof(float));
-	logits = malloc(OUTPUT_SIZE * sizeof(float));
+void init_training(int max_context)
+{
+	ensure_vocab_capacity(vocab_size);
+	if (softmax_mode == SOFTMAX_TREE &&
+		(!tree_ready || tree_vocab_size != vocab_size ||
+		 tree_hidden_size != hidden_sizes[num_hidden_layers - 1])) {
+		build_tree(hidden_sizes[num_hidden_layers - 1]);
+	}
 
+	num_workers = num_threads;
+	workers = malloc(num_workers * sizeof(train_worker));
+	for (int t = 0; t < num_workers; t++) {
+		init_worker(&workers[t], t);
+	}
+	pthread_barrier_init(&reduce_barrier, NULL, num_workers);
+	if (softmax_mode == SOFTMAX_SAMPLED) {
+		build_unigram_table();
+	}
+
+    // Mapped weights are read-only; training needs its own copy
+    make_weights_writable();
     if (first_time && !get_loaded_weights()) {
         // Initialize weights using He initialization
         for (int i = 0; i < num_hidden_layers; i++) {
@@ -70,35 +259,50 @@ void init_training(int max_context)
             int fan_out = hidden_sizes[i];
             he_init(W[i], fan_in, fan_out);
         }
-        he_init(W_output, hidden_sizes[num_hidden_layers - 1], OUTPUT_SIZE);
+        he_init(W_output, hidden_sizes[num_hidden_layers - 1], vocab_capacity);
         first_time = 0;
     }	
-    initial_lr = LEARNING_RATE;
+    // A resumed run keeps the base rate it was saved with; a fresh run,
+    // or one after the optimizer was changed, starts from the optimizer's
+    if (epochs_trained == 0 || initial_lr <= 0.0f) {
+        initial_lr = (optimizer_type == OPTIMIZER_SGD) ? LEARNING_RATE : adam_lr;
+    }
+    if (precision_mode == PRECISION_BF16) sync_bf16_weights();
     effective_context = max_context > context_window ? context_window : max_context;
 }
 
-void forward_pass(int i)
+// Builds the position-weighted input vector for the sample starting at i.
+// Returns 0 if the context holds an invalid token id.
+static int build_input(int i, float* x)
 {
-	memset(x_input_buffer, 0, MAX_EMBED * sizeof(float));
+	memset(x, 0, MAX_EMBED * sizeof(float));
 	for (int p = 0; p < effective_context; p++) {
 		int id = tokens[i + p];
 		if (id < 0 || id >= vocab_size) {
 			printf("Error: Invalid token ID %d at position %d (vocab_size=%d)\n", id, i+p, vocab_size);
-			return;
+			return 0;
 		}
 		float weight = 1.0f - (float)p / (float)effective_context * (float)POSITIONAL_DECAY_RATE;
 		for (int j = 0; j < MAX_EMBED; j++) {
-			x_input_buffer[j] += weight * (embed[id][j] + pos_embed[p % MAX_CONTEXT][j]);
+			x[j] += weight * (embed[id][j] + pos_embed[p % MAX_CONTEXT][j]);
 		}
 	}
+	return 1;
+}
+
+void forward_pass(train_worker* w, int i)
+{
+	double start = now_seconds(), t = start, flops = 0.0;
+	w->sample_pos = i;
+	if (!build_input(i, w->x_input_buffer)) return;
 	
 	// Print input statistics
 	if (i % 100 == 0) {
 		float input_sum = 0, input_max = -1e9, input_min = 1e9;
 		for (int j = 0; j < MAX_EMBED; j++) {
-			input_sum += x_input_buffer[j];
-			if (x_input_buffer[j] > input_max) input_max = x_input_buffer[j];
-			if (x_input_buffer[j] < input_min) input_min = x_input_buffer[j];
+			input_sum += w->x_input_buffer[j];
+			if (w->x_input_buffer[j] > input_max) input_max = w->x_input_buffer[j];
+			if (w->x_input_buffer[j] < input_min) input_min = w->x_input_buffer[j];
 		}
 		if (DEBUG) {
 			printf("  Input[%d]: avg=%.4f, min=%.4f, max=%.4f\n", 
@@ -107,19 +311,27 @@ void forward_pass(int i)
 	}
 
 	// Hidden layers forward pass
-	h_prev = x_input_buffer;
+	float* h_prev = w->x_input_buffer;
+	int prev_size = MAX_EMBED;
 	for (int layer = 0; layer < num_hidden_layers; layer++) {
 		int current_size = hidden_sizes[layer];
 		int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
-		fast_matmul(W[layer], h_prev, h_activations[layer], current_size, input_size);
+		if (layer == 0 && freeze_embeddings) {
+			// Frozen embeddings: layer 0 from the projection table
+			project_context(&tokens[i], effective_context, w->h_activations[0]);
+		} else if (W_bf16[layer]) {
+			fast_matmul_bf16(W_bf16[layer], h_prev, w->h_activations[layer], current_size, input_size);
+		} else {
+			fast_matmul(W[layer], h_prev, w->h_activations[layer], current_size, input_size);
+		}
 		
 		// Check pre-activation values
 		if (i % 100 == 0) {
 			float pre_act_sum = 0, pre_act_max = -1e9, pre_act_min = 1e9;
 			for (int j = 0; j < current_size; j++) {
-				pre_act_sum += h_activations[layer][j];
-				if (h_activations[layer][j] > pre_act_max) pre_act_max = h_activations[layer][j];
-				if (h_activations[layer][j] < pre_act_min) pre_act_min = h_activations[layer][j];
+				pre_act_sum += w->h_activations[layer][j];
+				if (w->h_activations[layer][j] > pre_act_max) pre_act_max = w->h_activations[layer][j];
+				if (w->h_activations[layer][j] < pre_act_min) pre_act_min = w->h_activations[layer][j];
 			}
 			if (DEBUG) {
 				printf("  Layer%d pre-ReLU[%d]: avg=%.4f, min=%.4f, max=%.4f\n", 
@@ -127,14 +339,14 @@ void forward_pass(int i)
 			}
 		}
 		
-		relu_and_dropout_combined(h_activations[layer], current_size, DROPOUT_RATE, 1);
+		relu_and_dropout_combined(w->h_activations[layer], current_size, DROPOUT_RATE, &w->rng);
 
 		// Check post-activation values
 		if (i % 100 == 0) {
 			float post_act_sum = 0, zeros = 0;
 			for (int j = 0; j < current_size; j++) {
-				post_act_sum += h_activations[layer][j];
-				if (h_activations[layer][j] == 0) zeros++;
+				post_act_sum += w->h_activations[layer][j];
+				if (w->h_activations[layer][j] == 0) zeros++;
 			}
 			if (DEBUG) {
 				printf("  Layer%d post-ReLU[%d]: avg=%.4f, zeros=%d/%d (%.1f%%)\n", 
@@ -142,92 +354,181 @@ void forward_pass(int i)
 				}
 		}
 
+		double layer_flops = 2.0 * current_size * ((layer == 0 && freeze_embeddings) ? effective_context : input_size);
+		t = prof_add(w->id, PROF_LAYER_FWD + layer, t, layer_flops);
+		flops += layer_flops;
+
 		// Set up the next layer's input
-		h_prev = h_activations[layer];
+		h_prev = w->h_activations[layer];
 		prev_size = current_size;
 	}
 
+	// Sampled softmax scores its candidates itself
+	if (softmax_mode != SOFTMAX_FULL) {
+		prof_add(w->id, PROF_FORWARD, start, flops);
+		return;
+	}
+
 	// Output layer forward pass
-	memset(logits, 0, OUTPUT_SIZE * sizeof(float));
-	fast_matmul(W_output, h_prev, logits, OUTPUT_SIZE, prev_size);
+	if (W_output_bf16) {
+		fast_matmul_bf16(W_output_bf16, h_prev, w->logits, vocab_size, prev_size);
+	} else {
+		fast_matmul(W_output, h_prev, w->logits, vocab_size, prev_size);
+	}
+	double output_flops = 2.0 * vocab_size * prev_size;
+	prof_add(w->id, PROF_LAYER_FWD + MAX_HIDDEN_LAYERS, t, output_flops);
 	
 	// Check output logits
 	if (i % 100 == 0) {
 		float logit_sum = 0, logit_max = -1e9, logit_min = 1e9;
 		for (int j = 0; j < vocab_size; j++) {
-			logit_sum += logits[j];
-			if (logits[j] > logit_max) logit_max = logits[j];
-			if (logits[j] < logit_min) logit_min = logits[j];
+			logit_sum += w->logits[j];
+			if (w->logits[j] > logit_max) logit_max = w->logits[j];
+			if (w->logits[j] < logit_min) logit_min = w->logits[j];
 		}
 		if (DEBUG) {
 			printf("  Logits[%d]: avg=%.4f, min=%.4f, max=%.4f\n", 
 				i, logit_sum/vocab_size, logit_min, logit_max);
 		}
 	}
+	prof_add(w->id, PROF_FORWARD, start, flops + output_flops);
 }
 
-void backward_pass()
+static double backward_hidden(train_worker* w, float* next_deltas, float* next_weights,
+                              const bf16* next_weights_bf16, int next_size);
+
+// Scatters the input gradient dx of the sample starting at i into the
+// context rows of embed and pos_embed it was built from (see build_input).
+// Costs effective_context row updates, independent of the vocab size.
+static void accumulate_embed_grad(train_worker* w, int i, const float* dx)
 {
-	// Calculate output layer deltas (error signal)
-	for (int j = 0; j < OUTPUT_SIZE; j++) {
-		if (j < vocab_size) {
-			output_deltas[j] = probs[j] - (j == target ? 1.0f : 0.0f);
-		} else {
-			output_deltas[j] = 0.0f;  // No gradient for unused outputs
+	for (int p = 0; p < effective_context; p++) {
+		int id = tokens[i + p];
+		if (id < 0 || id >= vocab_size) continue;
+		float weight = 1.0f - (float)p / (float)effective_context * (float)POSITIONAL_DECAY_RATE;
+		if (!w->embed_mark[id]) {
+			w->embed_mark[id] = 1;
+			w->embed_touched[w->num_touched++] = id;
 		}
+		simd->axpy(weight, dx, &w->d_embed[(size_t)id * MAX_EMBED], MAX_EMBED);
+		simd->axpy(weight, dx, &w->d_pos[(p % MAX_CONTEXT) * MAX_EMBED], MAX_EMBED);
+	}
+}
+
+void backward_pass(train_worker* w)
+{
+	double start = now_seconds();
+
+	// Calculate output layer deltas (error signal)
+	for (int j = 0; j < vocab_size; j++) {
+		w->output_deltas[j] = w->probs[j] - (j == w->target ? 1.0f : 0.0f);
 	}
 
 	// Update output weights gradients
-	for (int j = 0; j < OUTPUT_SIZE; j++) {
-		for (int k = 0; k < prev_size; k++) {
-			// Accumulate gradient
-			dW_output[j * prev_size + k] += output_deltas[j] * h_activations[num_hidden_layers - 1][k];
-		}
+	int prev_size = hidden_sizes[num_hidden_layers - 1];
+	for (int j = 0; j < vocab_size; j++) {
+		// Accumulate gradient
+		simd->axpy(w->output_deltas[j], w->h_activations[num_hidden_layers - 1],
+		           &w->dW_output[(size_t)j * prev_size], prev_size);
 	}
+	double output_flops = 2.0 * vocab_size * prev_size;
+	prof_add(w->id, PROF_LAYER_BWD + MAX_HIDDEN_LAYERS, start, output_flops);
 	
-	// Backpropagate through hidden layers
-	float* next_deltas = output_deltas;
-	int next_size = OUTPUT_SIZE;  // Use OUTPUT_SIZE for consistency
-	float* next_weights = W_output;
+	double flops = backward_hidden(w, w->output_deltas, W_output, W_output_bf16, vocab_size);
+	prof_add(w->id, PROF_BACKWARD, start, output_flops + flops);
+}
+
+// Backpropagate through hidden layers, starting from the error signal of
+// the output rows next_weights[0..next_size) (row width = last hidden size).
+// next_weights_bf16, when not NULL, is the bf16 copy of those rows.
+// Returns the nominal FLOPs.
+static double backward_hidden(train_worker* w, float* next_deltas, float* next_weights,
+                              const bf16* next_weights_bf16, int next_size)
+{
 	int next_input_size = hidden_sizes[num_hidden_layers - 1];
+	double t = now_seconds(), flops = 0.0;
 	
 	for (int layer = num_hidden_layers - 1; layer >= 0; layer--) {
-		float* h_current = (layer == 0) ? x_input_buffer : h_activations[layer - 1];
+		float* h_current = (layer == 0) ? w->x_input_buffer : w->h_activations[layer - 1];
 		int h_current_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
 		
-		// Calculate deltas for current layer
+		// Calculate deltas for current layer: W_next^T * next_deltas,
+		// streamed row by row instead of walking columns
+		if (next_weights_bf16) {
+			fast_matmul_t_bf16(next_weights_bf16, next_deltas, w->deltas[layer], next_size, next_input_size);
+		} else {
+			fast_matmul_t(next_weights, next_deltas, w->deltas[layer], next_size, next_input_size);
+		}
 		for (int j = 0; j < hidden_sizes[layer]; j++) {
-			float sum_err = 0.0f;
-			for (int k = 0; k < next_size; k++) {
-				sum_err += next_weights[k * next_input_size + j] * next_deltas[k];
-			}
 			// Derivative of ReLU (chain rule)
 			// This is where a dead ReLU neuron will have a delta of 0
-			if (h_activations[layer][j] > 0) {
-				deltas[layer][j] = sum_err;
-			} else {
-				deltas[layer][j] = 0;
+			if (w->h_activations[layer][j] <= 0) {
+				w->deltas[layer][j] = 0;
 			}
 		}
 		
 		// Update gradients for current layer
 		for (int j = 0; j < hidden_sizes[layer]; j++) {
-			for (int k = 0; k < h_current_size; k++) {
-				// Accumulate gradient
-				dW[layer][j * h_current_size + k] += deltas[layer][j] * h_current[k];
-			}
+			// Accumulate gradient (nothing to add for a dead ReLU)
+			if (w->deltas[layer][j] == 0.0f) continue;
+			simd->axpy(w->deltas[layer][j], h_current, &w->dW[layer][j * h_current_size], h_current_size);
 		}
+		double layer_flops = 2.0 * next_size * next_input_size + 2.0 * hidden_sizes[layer] * h_current_size;
+		t = prof_add(w->id, PROF_LAYER_BWD + layer, t, layer_flops);
+		flops += layer_flops;
 
 		// Prepare for next layer (going backwards)
-		next_deltas = deltas[layer];
+		next_deltas = w->deltas[layer];
 		next_size = hidden_sizes[layer];
 		next_weights = W[layer];
+		next_weights_bf16 = W_bf16[layer];
 		next_input_size = h_current_size;
 	}
+
+	// Continue into the embeddings the input was built from
+	if (freeze_embeddings) return flops;
+	if (W_bf16[0]) {
+		fast_matmul_t_bf16(W_bf16[0], w->deltas[0], w->dx, hidden_sizes[0], MAX_EMBED);
+	} else {
+		fast_matmul_t(W[0], w->deltas[0], w->dx, hidden_sizes[0], MAX_EMBED);
+	}
+	accumulate_embed_grad(w, w->sample_pos, w->dx);
+	return flops + 2.0 * hidden_sizes[0] * MAX_EMBED;
+}
+
+// Adam/AdamW variant of update_weights(): one fused clip + moments +
+// weight pass per tensor, touching only this epoch's embedding rows.
+static void adam_update_weights(train_worker* w)
+{
+	adam_begin_step(current_lr);
+	for (int layer = 0; layer < num_hidden_layers; layer++) {
+		int input_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+		adam_update(layer, W[layer], w->dW[layer], 0, hidden_sizes[layer] * input_size);
+	}
+	// The tree replaces W_output: its gradient is all zeros, and a step
+	// would still apply weight decay and stale momentum to it
+	if (softmax_mode == SOFTMAX_TREE) {
+		adam_update(ADAM_TREE, W_tree, w->dW_tree, 0, (tree_vocab_size - 1) * tree_hidden_size);
+	} else {
+		adam_update(ADAM_OUTPUT, W_output, w->dW_output, 0, vocab_size * hidden_sizes[num_hidden_layers - 1]);
+	}
+	for (int r = 0; r < w->num_touched; r++) {
+		size_t row = (size_t)w->embed_touched[r] * MAX_EMBED;
+		adam_update(ADAM_EMBED, embed[0], w->d_embed, row, MAX_EMBED);
+	}
+	if (!freeze_embeddings) {
+		adam_update(ADAM_POS, pos_embed[0], w->d_pos, 0, MAX_CONTEXT * MAX_EMBED);
+	}
 }
 
 void update_weights()
 {
+	train_worker* w = &workers[0];  // holds the reduced gradients
+	if (optimizer_type != OPTIMIZER_SGD) {
+		adam_update_weights(w);
+		return;
+	}
+
 	// ---- WEIGHT UPDATE PASS (AFTER ALL BATCH GRADIENTS ARE CALCULATED) ----
 	// This is a more stable approach than updating every iteration
 	// Update output weights - fix dimension mismatch
@@ -237,24 +538,34 @@ void update_weights()
 	float grad_sum = 0, grad_max = -1e9, grad_min = 1e9;
 	int grad_count = 0;
 	
-	for (int j = 0; j < OUTPUT_SIZE; j++) {  // Use OUTPUT_SIZE, not vocab_size
+	// Tree mode leaves dW_output zero; skip the sweep
+	for (int j = 0; j < vocab_size && softmax_mode != SOFTMAX_TREE; j++) {
 		for (int k = 0; k < final_layer_size; k++) {
-			if (j < vocab_size) {  // Only update weights for actual vocabulary
-				float grad = dW_output[j * final_layer_size + k];  // Remove division - raw accumulated gradient
-				
-				grad_sum += fabsf(grad);
-				if (grad > grad_max) grad_max = grad;
-				if (grad < grad_min) grad_min = grad;
-				grad_count++;
+			float grad = w->dW_output[j * final_layer_size + k];  // Remove division - raw accumulated gradient
+			
+			grad_sum += fabsf(grad);
+			if (grad > grad_max) grad_max = grad;
+			if (grad < grad_min) grad_min = grad;
+			grad_count++;
 
-				// Gradient clipping - slightly looser for faster learning
-				if (grad > 0.5f) grad = 0.5f;   // Increase from 0.1f to 0.5f
-				if (grad < -0.5f) grad = -0.5f;
-				W_output[j * final_layer_size + k] -= current_lr * grad;
-			}
+			// Gradient clipping - slightly looser for faster learning
+			if (grad > 0.5f) grad = 0.5f;   // Increase from 0.1f to 0.5f
+			if (grad < -0.5f) grad = -0.5f;
+			W_output[j * final_layer_size + k] -= current_lr * grad;
 		}
 	}
 	
+	// Hierarchical softmax inner nodes, same clipped SGD step
+	if (softmax_mode == SOFTMAX_TREE) {
+		size_t tree_len = (size_t)(tree_vocab_size - 1) * tree_hidden_size;
+		for (size_t k = 0; k < tree_len; k++) {
+			float grad = w->dW_tree[k];
+			if (grad > 0.5f) grad = 0.5f;
+			if (grad < -0.5f) grad = -0.5f;
+			W_tree[k] -= current_lr * grad;
+		}
+	}
+
 	if (DEBUG) {
 		printf("  Output grads: avg=%.6f, min=%.6f, max=%.6f, lr=%.6f\n", 
 			grad_sum/grad_count, grad_min, grad_max, current_lr);
@@ -270,7 +581,7 @@ void update_weights()
 		
 		for (int j = 0; j < current_size; j++) {
 			for (int k = 0; k < input_size; k++) {
-				float grad = dW[layer][j * input_size + k];  // Remove division - raw accumulated gradient
+				float grad = w->dW[layer][j * input_size + k];  // Remove division - raw accumulated gradient
 				hidden_grad_sum += fabsf(grad);
 				hidden_grad_count++;
 				
@@ -288,26 +599,36 @@ void update_weights()
 			printf("  Layer%d grads: avg=%.6f\n", layer, hidden_grad_sum/hidden_grad_count);
 		}
 	}
-}
 
-void softmax()
-{
-	// Softmax - ensure we don't exceed either array bounds
-	int max_vocab_idx = (vocab_size < OUTPUT_SIZE) ? vocab_size : OUTPUT_SIZE;
-	
-	float max_logit = logits[0];
-	for (int j = 1; j < max_vocab_idx; j++) {
-		if (logits[j] > max_logit) max_logit = logits[j];
+	// Embeddings: only the rows touched this epoch, same clipped SGD step
+	for (int r = 0; r < w->num_touched; r++) {
+		int id = w->embed_touched[r];
+		const float* grad_row = &w->d_embed[(size_t)id * MAX_EMBED];
+		for (int k = 0; k < MAX_EMBED; k++) {
+			float grad = grad_row[k];
+			if (grad > 0.5f) grad = 0.5f;
+			if (grad < -0.5f) grad = -0.5f;
+			embed[id][k] -= current_lr * grad;
+		}
 	}
-	float sum_exp = 0;
-	for (int j = 0; j < vocab_size; j++) {
-		if (j < OUTPUT_SIZE) {
-			probs[j] = expf(logits[j] - max_logit);
-		} else {
-			probs[j] = 0.0f;  // Should never happen if sizes are correct
+	for (int p = 0; p < MAX_CONTEXT && !freeze_embeddings; p++) {
+		for (int k = 0; k < MAX_EMBED; k++) {
+			float grad = w->d_pos[p * MAX_EMBED + k];
+			if (grad > 0.5f) grad = 0.5f;
+			if (grad < -0.5f) grad = -0.5f;
+			pos_embed[p][k] -= current_lr * grad;
 		}
-		sum_exp += probs[j];
 	}
+	if (DEBUG) {
+		printf("  Embedding rows updated: %d of %d\n", w->num_touched, vocab_size);
+	}
+}
+
+void softmax(train_worker* w)
+{
+	float max_logit = simd->max(w->logits, vocab_size);
+	memcpy(w->probs, w->logits, vocab_size * sizeof(float));
+	float sum_exp = simd->exp_sum(w->probs, vocab_size, max_logit);
 	
 	// Check for numerical issues
 	if (sum_exp == 0 || !isfinite(sum_exp)) {
@@ -315,58 +636,251 @@ void softmax()
 		sum_exp = 1e-8f;  // Prevent division by zero
 	}
 	
-	for (int j = 0; j < vocab_size; j++) {
-		probs[j] /= sum_exp;
+	simd->scale(w->probs, vocab_size, 1.0f / sum_exp);
+}
+
+// Mini-batch forward pass over samples [start, start + n).
+// Each layer runs as one matrix-matrix product over the whole batch.
+// A row whose context holds an invalid id gets a zero input and is
+// marked in batch_valid; softmax_batch then gives it no delta.
+void forward_pass_batch(train_worker* w, int start, int n)
+{
+	double begin = now_seconds(), flops = 0.0;
+	w->sample_pos = start;
+	for (int b = 0; b < n; b++) {
+		w->batch_valid[b] = (unsigned char)build_input(start + b, &w->x_batch[b * MAX_EMBED]);
+		if (!w->batch_valid[b]) memset(&w->x_batch[b * MAX_EMBED], 0, MAX_EMBED * sizeof(float));
+	}
+	double t = now_seconds();
+
+	float* in = w->x_batch;
+	int in_size = MAX_EMBED;
+	for (int layer = 0; layer < num_hidden_layers; layer++) {
+		int current_size = hidden_sizes[layer];
+		if (layer == 0 && freeze_embeddings) {
+			for (int b = 0; b < n; b++) {
+				float* h = &w->h_batch[0][b * current_size];
+				if (w->batch_valid[b]) project_context(&tokens[start + b], effective_context, h);
+				else memset(h, 0, current_size * sizeof(float));
+			}
+		} else if (W_bf16[layer]) {
+			fast_gemm_nt_bf16(in, W_bf16[layer], w->h_batch[layer], n, current_size, in_size);
+		} else {
+			fast_gemm_nt(in, W[layer], w->h_batch[layer], n, current_size, in_size);
+		}
+		relu_and_dropout_combined(w->h_batch[layer], n * current_size, DROPOUT_RATE, &w->rng);
+		double layer_flops = 2.0 * n * current_size * ((layer == 0 && freeze_embeddings) ? effective_context : in_size);
+		t = prof_add(w->id, PROF_LAYER_FWD + layer, t, layer_flops);
+		flops += layer_flops;
+		in = w->h_batch[layer];
+		in_size = current_size;
 	}
+
+	// Only rows for real vocabulary entries can carry a gradient
+	if (W_output_bf16) {
+		fast_gemm_nt_bf16(in, W_output_bf16, w->logits_batch, n, vocab_size, in_size);
+	} else {
+		fast_gemm_nt(in, W_output, w->logits_batch, n, vocab_size, in_size);
+	}
+	double output_flops = 2.0 * n * vocab_size * in_size;
+	prof_add(w->id, PROF_LAYER_FWD + MAX_HIDDEN_LAYERS, t, output_flops);
+	prof_add(w->id, PROF_FORWARD, begin, flops + output_flops);
+}
+
+// Row-wise softmax of the batch logits, followed by output deltas
+// (probs - one_hot(target)) written in place. Rows with an invalid
+// context are skipped with a zero delta. Returns the summed loss.
+float softmax_batch(train_worker* w, int start, int n)
+{
+	double begin = now_seconds();
+	float loss = 0.0f;
+	for (int b = 0; b < n; b++) {
+		float* row = &w->logits_batch[(size_t)b * vocab_size];
+		if (!w->batch_valid[b]) {
+			memset(row, 0, vocab_size * sizeof(float));
+			continue;
+		}
+		float max_logit = simd->max(row, vocab_size);
+		float sum_exp = simd->exp_sum(row, vocab_size, max_logit);
+		if (sum_exp == 0 || !isfinite(sum_exp)) {
+			printf("Error: sum_exp=%f, max_logit=%f\n", sum_exp, max_logit);
+			sum_exp = 1e-8f;
+		}
+		simd->scale(row, vocab_size, 1.0f / sum_exp);
+
+		int t = tokens[start + b + effective_context];
+		if (t >= 0 && t < vocab_size) {
+			loss += -logf(row[t] + 1e-8f);
+			row[t] -= 1.0f;
+		} else {
+			printf("Warning: Invalid target token %d at position %d\n", t, start + b + effective_context);
+			loss += 10.0f;
+		}
+	}
+	prof_add(w->id, PROF_SOFTMAX, begin, 0.0);
+	return loss;
 }
 
-void clear_gradients()
+// Mini-batch backward pass: gradients are accumulated for the whole
+// batch with one matrix-matrix product per layer.
+void backward_pass_batch(train_worker* w, int n)
+{
+	int last = num_hidden_layers - 1;
+	int last_size = hidden_sizes[last];
+	double begin = now_seconds(), t = begin;
+
+	// dW_output[0:vocab_size] += deltas^T * h_last
+	fast_gemm_tn_acc(w->logits_batch, w->h_batch[last], w->dW_output, vocab_size, last_size, n);
+	double flops = 2.0 * n * vocab_size * last_size;
+	t = prof_add(w->id, PROF_LAYER_BWD + MAX_HIDDEN_LAYERS, t, flops);
+
+	float* next_deltas = w->logits_batch;
+	float* next_weights = W_output;
+	const bf16* next_weights_bf16 = W_output_bf16;
+	int next_size = vocab_size;
+
+	for (int layer = last; layer >= 0; layer--) {
+		int current_size = hidden_sizes[layer];
+		float* h_current = (layer == 0) ? w->x_batch : w->h_batch[layer - 1];
+		int h_current_size = (layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1];
+
+		// deltas = (next_deltas * next_weights) masked by the ReLU derivative
+		if (next_weights_bf16) {
+			fast_gemm_nn_bf16(next_deltas, next_weights_bf16, w->delta_batch[layer], n, current_size, next_size);
+		} else {
+			fast_gemm_nn(next_deltas, next_weights, w->delta_batch[layer], n, current_size, next_size);
+		}
+		for (int j = 0; j < n * current_size; j++) {
+			if (w->h_batch[layer][j] <= 0) w->delta_batch[layer][j] = 0;
+		}
+
+		fast_gemm_tn_acc(w->delta_batch[layer], h_current, w->dW[layer], current_size, h_current_size, n);
+		double layer_flops = 2.0 * n * current_size * (next_size + h_current_size);
+		t = prof_add(w->id, PROF_LAYER_BWD + layer, t, layer_flops);
+		flops += layer_flops;
+
+		next_deltas = w->delta_batch[layer];
+		next_weights = W[layer];
+		next_weights_bf16 = W_bf16[layer];
+		next_size = current_size;
+	}
+
+	// dx = deltas * W[0], scattered into each sample's embedding rows
+	if (!freeze_embeddings) {
+		if (W_bf16[0]) {
+			fast_gemm_nn_bf16(w->delta_batch[0], W_bf16[0], w->dx_batch, n, MAX_EMBED, hidden_sizes[0]);
+		} else {
+			fast_gemm_nn(w->delta_batch[0], W[0], w->dx_batch, n, MAX_EMBED, hidden_sizes[0]);
+		}
+		for (int b = 0; b < n; b++) {
+			if (w->batch_valid[b]) accumulate_embed_grad(w, w->sample_pos + b, &w->dx_batch[b * MAX_EMBED]);
+		}
+		flops += 2.0 * n * hidden_sizes[0] * MAX_EMBED;
+	}
+	prof_add(w->id, PROF_BACKWARD, begin, flops);
+}
+
+void clear_gradients(train_worker* w)
 {
 	// Clear gradients for the next epoch
 	for (int i = 0; i < num_hidden_layers; i++) {
-		memset(dW[i], 0, hidden_sizes[i] * ((i == 0) ? MAX_EMBED : hidden_sizes[i - 1]) * sizeof(float));
+		memset(w->dW[i], 0, hidden_sizes[i] * ((i == 0) ? MAX_EMBED : hidden_sizes[i - 1]) * sizeof(float));
 	}
 	int output_layer_size = hidden_sizes[num_hidden_layers - 1];
-	memset(dW_output, 0, OUTPUT_SIZE * output_layer_size * sizeof(float));
+	memset(w->dW_output, 0, (size_t)vocab_size * output_layer_size * sizeof(float));
+	if (w->dW_tree) {
+		memset(w->dW_tree, 0, (size_t)(tree_vocab_size - 1) * tree_hidden_size * sizeof(float));
+	}
+
+	// Only the touched embedding rows can be nonzero
+	for (int r = 0; r < w->num_touched; r++) {
+		int id = w->embed_touched[r];
+		memset(&w->d_embed[(size_t)id * MAX_EMBED], 0, MAX_EMBED * sizeof(float));
+		w->embed_mark[id] = 0;
+	}
+	w->num_touched = 0;
+	memset(w->d_pos, 0, MAX_CONTEXT * MAX_EMBED * sizeof(float));
 }
 
-void training_cleanup()
+static void free_worker(train_worker* w)
 {
     // Free allocated memory
     for (int i = 0; i < num_hidden_layers; i++) {
-        free(dW[i]);
-        free(h_activations[i]);
-        free(deltas[i]);
+        free(w->dW[i]);
+        free(w->h_activations[i]);
+        free(w->deltas[i]);
     }
-    free(dW);
-    free(dW_output);
-    free(h_activations);
-    free(x_input_buffer);
-    free(deltas);
-    free(output_deltas);
-	free(probs);
-	free(logits);
+    free(w->dW);
+    free(w->dW_output);
+    free(w->h_activations);
+    free(w->x_input_buffer);
+    free(w->deltas);
+    free(w->output_deltas);
+	free(w->probs);
+	free(w->logits);
+	free(w->sample_ids);
+	free(w->sample_rows);
+	free(w->sample_deltas);
+	free(w->dW_tree);
+	free(w->d_embed);
+	free(w->embed_touched);
+	free(w->embed_mark);
+	free(w->d_pos);
+	free(w->dx);
+
+	if (w->x_batch) {
+		for (int i = 0; i < num_hidden_layers; i++) {
+			free(w->h_batch[i]);
+			free(w->delta_batch[i]);
+		}
+		free(w->h_batch);
+		free(w->delta_batch);
+		free(w->x_batch);
+		free(w->logits_batch);
+		free(w->dx_batch);
+		free(w->batch_valid);
+		w->x_batch = NULL;
+		w->h_batch = w->delta_batch = NULL;
+		w->logits_batch = NULL;
+	}
 }
 
-void report_progress(int training_epoch, float total_loss, time_t epoch_start)
+void training_cleanup()
+{
+	for (int t = 0; t < num_workers; t++) {
+		free_worker(&workers[t]);
+	}
+	free(workers);
+	workers = NULL;
+	num_workers = 0;
+	pthread_barrier_destroy(&reduce_barrier);
+	free_bf16_weights();
+	free(unigram_table);
+	free(unigram_logq);
+	unigram_table = NULL;
+	unigram_logq = NULL;
+}
+
+void report_progress(int training_epoch, float total_loss, double epoch_seconds)
 {
 	// Progress reporting
 	if (training_epoch % 5 == 0 || training_epoch < 20) {
 		float avg_loss = total_loss / (float)(token_count - effective_context - 1);
 		
-		// Get current timestamp and calculate epoch duration
+		// Current timestamp; the epoch duration comes from the monotonic clock
 		time_t now = time(NULL);
 		struct tm *t = localtime(&now);
-		double epoch_duration = difftime(now, epoch_start);
+		int samples = token_count - effective_context - 1;
 		
-		printf("[%02d:%02d:%02d] Epoch %05d Loss: %.4f Avg Loss: %.4f LR: %.6f Time: %.1fs\n",
-				t->tm_hour, t->tm_min, t->tm_sec, training_epoch, total_loss, avg_loss, current_lr, epoch_duration);
+		printf("[%02d:%02d:%02d] Epoch %05d Loss: %.4f Avg Loss: %.4f LR: %.6f Time: %.3fs (%.0f samples/s)\n",
+				t->tm_hour, t->tm_min, t->tm_sec, training_epoch, total_loss, avg_loss, current_lr,
+				epoch_seconds, epoch_seconds > 0.0 ? samples / epoch_seconds : 0.0);
 				
 		// Print weight statistics every 20 epochs
 		if (training_epoch % 20 == 0) {
 			float w_sum = 0, w_max = -1e9, w_min = 1e9;
 			int w_count = 0;
-			for (int j = 0; j < vocab_size && j < OUTPUT_SIZE; j++) {
+			for (int j = 0; j < vocab_size; j++) {
 				for (int k = 0; k < final_layer_size; k++) {
 					float w = W_output[j * final_layer_size + k];
 					w_sum += fabsf(w);
@@ -388,47 +902,353 @@ void report_progress(int training_epoch, float total_loss, time_t epoch_start)
 	}
 }
 
+// Sampled softmax step for one sample whose hidden activations are
+// already computed: scores the target and num_negatives tokens drawn from
+// the unigram^0.75 table, applies the log-q correction, and backpropagates
+// through only those W_output rows. Returns the sampled loss.
+static float sampled_softmax_step(train_worker* w)
+{
+	double t = now_seconds();
+	int hidden = hidden_sizes[num_hidden_layers - 1];
+	float* h = w->h_activations[num_hidden_layers - 1];
+	int n = 1;
+
+	// Negatives that hit the target are redrawn a few times, then dropped,
+	// so a table dominated by the target cannot stall the step
+	w->sample_ids[0] = w->target;
+	for (int s = 0; s < num_negatives; s++) {
+		for (int tries = 0; tries < NEGATIVE_REDRAWS; tries++) {
+			int id = unigram_table[(rng_next(&w->rng) >> 32) % UNIGRAM_TABLE_SIZE];
+			if (id != w->target) {
+				w->sample_ids[n++] = id;
+				break;
+			}
+		}
+	}
+
+	// Gather candidate rows and score them
+	float max_logit = -1e30f;
+	for (int s = 0; s < n; s++) {
+		float* row = &w->sample_rows[s * hidden];
+		memcpy(row, &W_output[w->sample_ids[s] * hidden], hidden * sizeof(float));
+		float z = simd->dot(row, h, hidden) - unigram_logq[w->sample_ids[s]];
+		w->sample_deltas[s] = z;
+		if (z > max_logit) max_logit = z;
+	}
+	float sum_exp = 0.0f;
+	for (int s = 0; s < n; s++) {
+		w->sample_deltas[s] = expf(w->sample_deltas[s] - max_logit);
+		sum_exp += w->sample_deltas[s];
+	}
+	float loss = -logf(w->sample_deltas[0] / sum_exp + 1e-8f);
+
+	// deltas = p - one_hot(target), accumulated into the sampled rows only
+	for (int s = 0; s < n; s++) {
+		float delta = w->sample_deltas[s] / sum_exp - (s == 0 ? 1.0f : 0.0f);
+		w->sample_deltas[s] = delta;
+		simd->axpy(delta, h, &w->dW_output[w->sample_ids[s] * hidden], hidden);
+	}
+	t = prof_add(w->id, PROF_SOFTMAX, t, 4.0 * n * hidden);
+
+	prof_add(w->id, PROF_BACKWARD, t, backward_hidden(w, w->sample_deltas, w->sample_rows, NULL, n));
+	return loss;
+}
+
+// Hierarchical softmax step: walks the target's Huffman path, scoring
+// each inner node with a sigmoid, and backpropagates through only those
+// O(log V) node vectors. Returns -log P(target).
+static float tree_softmax_step(train_worker* w)
+{
+	double t = now_seconds();
+	int hidden = hidden_sizes[num_hidden_layers - 1];
+	float* h = w->h_activations[num_hidden_layers - 1];
+	int begin = tree_path_offset[w->target];
+	int n = tree_path_offset[w->target + 1] - begin;
+	float loss = 0.0f;
+
+	for (int s = 0; s < n; s++) {
+		int node = tree_path_node[begin + s];
+		float bit = (float)tree_path_bit[begin + s];
+		float* row = &w->sample_rows[s * hidden];
+		memcpy(row, &W_tree[(size_t)node * hidden], hidden * sizeof(float));
+		float z = simd->dot(row, h, hidden);
+		float p = 1.0f / (1.0f + expf(-z));  // P(branch 1)
+		loss += -logf((bit > 0.5f ? p : 1.0f - p) + 1e-8f);
+
+		// d(-log P)/dz = p - bit
+		float delta = p - bit;
+		w->sample_deltas[s] = delta;
+		simd->axpy(delta, h, &w->dW_tree[(size_t)node * hidden], hidden);
+	}
+	t = prof_add(w->id, PROF_SOFTMAX, t, 4.0 * n * hidden);
+
+	prof_add(w->id, PROF_BACKWARD, t, backward_hidden(w, w->sample_deltas, w->sample_rows, NULL, n));
+	return loss;
+}
+
+// Single-sample forward, softmax and backward pass. Returns the sample loss.
+static float train_sample(train_worker* w, int i)
+{
+	forward_pass(w, i);
+	if (softmax_mode != SOFTMAX_FULL) {
+		w->target = tokens[i + effective_context];
+		if (w->target < 0 || w->target >= vocab_size) {
+			printf("Warning: Invalid target token %d at position %d\n", w->target, i + effective_context);
+			return 10.0f;
+		}
+		if (softmax_mode == SOFTMAX_TREE) return tree_softmax_step(w);
+		return sampled_softmax_step(w);
+	}
+	double t = now_seconds();
+	softmax(w);
+
+	// Calculate loss
+	float sample_loss;
+	w->target = tokens[i + effective_context];
+	if (w->target >= 0 && w->target < vocab_size) {
+		sample_loss = -logf(w->probs[w->target] + 1e-8f);
+	} else {
+		printf("Warning: Invalid target token %d at position %d\n", w->target, i + effective_context);
+		sample_loss = 10.0f;  // Large penalty for invalid tokens
+	}
+	prof_add(w->id, PROF_SOFTMAX, t, 0.0);
+	backward_pass(w);
+	return sample_loss;
+}
+
+static float* grad_tensor(train_worker* w, int layer)
+{
+	if (layer == -3) return w->d_pos;
+	if (layer == -2) return w->dW_tree;
+	return (layer < 0) ? w->dW_output : w->dW[layer];
+}
+
+// Sums slice [part/parts] of every worker's copy of a gradient tensor
+// (layer -1 is the output layer, -2 the tree, -3 pos_embed) into worker 0's copy. Each thread
+// reduces a disjoint slice, so the reduction runs in parallel without locks.
+static void reduce_slice(int layer, size_t len, int part, int parts)
+{
+	size_t begin = len * part / parts;
+	size_t end = len * (part + 1) / parts;
+	float* dst = grad_tensor(&workers[0], layer);
+	for (int t = 1; t < num_workers; t++) {
+		const float* src = grad_tensor(&workers[t], layer);
+		for (size_t k = begin; k < end; k++) dst[k] += src[k];
+	}
+}
+
+// Adds src's sparse embedding gradients into dst, extending dst's
+// touched-row list. Runs after the join; it only visits touched rows.
+static void merge_embed_grad(train_worker* dst, train_worker* src)
+{
+	for (int r = 0; r < src->num_touched; r++) {
+		int id = src->embed_touched[r];
+		if (!dst->embed_mark[id]) {
+			dst->embed_mark[id] = 1;
+			dst->embed_touched[dst->num_touched++] = id;
+		}
+		simd->axpy(1.0f, &src->d_embed[(size_t)id * MAX_EMBED], &dst->d_embed[(size_t)id * MAX_EMBED], MAX_EMBED);
+	}
+}
+
+// Runs one worker's share of an epoch, then its slice of the reduction.
+static void* train_worker_run(void* arg)
+{
+	train_worker* w = (train_worker*)arg;
+	float loss = 0.0f;
+
+	clear_gradients(w);
+	if (batch_size > 1 && softmax_mode == SOFTMAX_FULL) {
+		for (int i = w->sample_start; i < w->sample_end; i += batch_size) {
+			int n = (w->sample_end - i < batch_size) ? w->sample_end - i : batch_size;
+			forward_pass_batch(w, i, n);
+			loss += softmax_batch(w, i, n);
+			backward_pass_batch(w, n);
+		}
+	} else {
+		for (int i = w->sample_start; i < w->sample_end; i++) {
+			loss += train_sample(w, i);
+		}
+	}
+	w->loss = loss;
+
+	if (num_workers > 1) {
+		// Wait until every worker's gradients are complete (the wait is
+		// profiled as part of the reduction: it is load imbalance)
+		double t = now_seconds();
+		pthread_barrier_wait(&reduce_barrier);
+		for (int layer = 0; layer < num_hidden_layers; layer++) {
+			size_t len = (size_t)hidden_sizes[layer] * ((layer == 0) ? MAX_EMBED : hidden_sizes[layer - 1]);
+			reduce_slice(layer, len, w->id, num_workers);
+		}
+		if (softmax_mode == SOFTMAX_TREE) {
+			reduce_slice(-2, (size_t)(tree_vocab_size - 1) * tree_hidden_size, w->id, num_workers);
+		} else {
+			size_t out_len = (size_t)vocab_size * hidden_sizes[num_hidden_layers - 1];
+			reduce_slice(-1, out_len, w->id, num_workers);
+		}
+		reduce_slice(-3, MAX_CONTEXT * MAX_EMBED, w->id, num_workers);
+		prof_add(w->id, PROF_REDUCE, t, 0.0);
+	}
+	return NULL;
+}
+
+// Splits the epoch's samples across the workers and runs them on their
+// own threads (worker 0 on the calling thread). Returns the total loss;
+// the summed gradients are left in worker 0.
+static float run_epoch(int num_samples)
+{
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS] = {0};
+
+	// Streams depend only on the seed, epoch and worker, so a seeded run
+	// repeats exactly at the same thread count, even across restarts
+	for (int t = 0; t < num_workers; t++) {
+		workers[t].rng = rng_seed(training_seed() + (uint64_t)epochs_trained * MAX_THREADS + t);
+		workers[t].sample_start = (int)((long long)num_samples * t / num_workers);
+		workers[t].sample_end = (int)((long long)num_samples * (t + 1) / num_workers);
+	}
+	for (int t = 1; t < num_workers; t++) {
+		if (pthread_create(&threads[t], NULL, train_worker_run, &workers[t]) != 0) {
+			printf("Error: Could not start training thread %d\n", t);
+			exit(1);
+		}
+		started[t] = 1;
+	}
+	train_worker_run(&workers[0]);
+
+	float total_loss = workers[0].loss;
+	for (int t = 1; t < num_workers; t++) {
+		if (started[t]) pthread_join(threads[t], NULL);
+		total_loss += workers[t].loss;
+	}
+	if (num_workers > 1) {
+		double t0 = now_seconds();
+		for (int t = 1; t < num_workers; t++) {
+			merge_embed_grad(&workers[0], &workers[t]);
+		}
+		prof_add(0, PROF_REDUCE, t0, 0.0);
+	}
+	return total_loss;
+}
+
+/**
+ * Times the single-sample training step on the first samples windows of
+ * tokens[] with one worker: forward_pass, softmax + backward_pass, and
+ * update_weights, applied after every sample here rather than once per
+ * epoch. Writes the mean seconds per sample to times[0..2] and returns
+ * the number of samples timed.
+ *
+ * Benchmark only: the updates are applied to the live global model, so
+ * the weights (and Adam moments) are changed when it returns. It needs
+ * the worker internals, which is why it lives here; call it only from
+ * brook_bench, never from the interactive or serving paths.
+ */
+int train_step_times(int samples, double times[3])
+{
+	int saved_threads = num_threads, saved_batch = batch_size, saved_softmax = softmax_mode;
+	num_threads = 1;
+	batch_size = 1;
+	softmax_mode = SOFTMAX_FULL;
+	init_training(context_window);
+	current_lr = initial_lr;
+	int available = token_count - effective_context - 1;
+	if (samples > available) samples = available;
+	train_worker* w = &workers[0];
+	double sum[3] = { 0.0, 0.0, 0.0 };
+	clear_gradients(w);
+	for (int i = 0; i < samples; i++) {
+		double t0 = now_seconds();
+		forward_pass(w, i);
+		double t1 = now_seconds();
+		softmax(w);
+		w->target = tokens[i + effective_context];
+		backward_pass(w);
+		double t2 = now_seconds();
+		update_weights();
+		clear_gradients(w);
+		double t3 = now_seconds();
+		sum[0] += t1 - t0;
+		sum[1] += t2 - t1;
+		sum[2] += t3 - t2;
+	}
+	for (int k = 0; k < 3; k++) times[k] = samples > 0 ? sum[k] / samples : 0.0;
+	training_cleanup();
+	invalidate_projection();
+	invalidate_mips();
+	num_threads = saved_threads;
+	batch_size = saved_batch;
+	softmax_mode = saved_softmax;
+	return samples;
+}
+
+/**
+ * The learning rate of a training epoch: initial_lr decayed by DECAY_RATE
+ * every 10 epochs, floored at 1% of it. The schedule follows the epoch
+ * count saved with the model, so a resumed run picks up where the
+ * checkpoint left off.
+ */
+float scheduled_lr(int epoch) {
+	float lr = initial_lr * powf(DECAY_RATE, epoch / 10.0f);
+	return lr < initial_lr * 0.01f ? initial_lr * 0.01f : lr;
+}
+
 // Function to perform the training loop with backpropagation
 void train(int max_context, int epochs) {
 	init_training(max_context);
+	if (quant_ready) {
+		// The int8 copy would go stale; run "quantize" again after training
+		printf("Dropping int8 weights; they no longer match the trained model\n");
+		free_quantized();
+	}
 
     printf("Vocab size: %d, Token count: %d, Effective context: %d\n", 
            vocab_size, token_count, effective_context);
     printf("Hidden layers: %d, Hidden sizes: %d, %d, %d\n", num_hidden_layers, 
 		hidden_sizes[0], hidden_sizes[1], hidden_sizes[2]);
-    printf("Training samples: %d\n", token_count - effective_context - 1);
-	printf("Initial learning rate: %.6f, Context window: %d\n", 
-		   initial_lr, context_window);
-
-    for (int training_epoch = 0; training_epoch < epochs; training_epoch++) {
-        time_t epoch_start = time(NULL);
-
-        // Calculate the current learning rate with decay.
-        current_lr = initial_lr * powf(DECAY_RATE, training_epoch / 10.0f);
-        if (current_lr < initial_lr * 0.01f) current_lr = initial_lr * 0.01f;
-        float total_loss = 0.0f;
-
-        for (int i = 0; i < token_count - effective_context - 1; i++) {
-			forward_pass(i);
-			softmax();
-
-            // Calculate loss
-            target = tokens[i + effective_context];
-            if (target >= 0 && target < vocab_size) {
-                float sample_loss = -logf(probs[target] + 1e-8f);
-                total_loss += sample_loss;
-            } else {
-                printf("Warning: Invalid target token %d at position %d\n", target, i + effective_context);
-                total_loss += 10.0f;  // Large penalty for invalid tokens
-            }
-			backward_pass();
-        }
+    printf("Training samples: %d, Batch size: %d, Threads: %d\n",
+           token_count - effective_context - 1, batch_size, num_workers);
+	printf("Initial learning rate: %.6f, Context window: %d, Optimizer: %s, Precision: %s\n", 
+		   initial_lr, context_window, optimizer_name(),
+		   precision_mode == PRECISION_BF16 ? "bf16" : "fp32");
+	if (softmax_mode == SOFTMAX_SAMPLED) {
+		printf("Sampled softmax: %d negatives per sample (loss is the sampled estimate)\n", num_negatives);
+	} else if (softmax_mode == SOFTMAX_TREE) {
+		printf("Hierarchical softmax: max path length %d\n", tree_max_depth);
+	}
+	if (softmax_mode != SOFTMAX_FULL && batch_size > 1) {
+		// Only the full softmax has a batched output step
+		printf("Batch size %d is ignored with %s softmax: training runs per sample\n",
+		       batch_size, softmax_mode == SOFTMAX_TREE ? "tree" : "sampled");
+	}
+
+	if (epochs_trained > 0) {
+		printf("Resuming at epoch %d\n", epochs_trained);
+	}
+
+    for (int i = 0; i < epochs; i++) {
+        int training_epoch = epochs_trained;
+        int samples = token_count - effective_context - 1;
+        double epoch_start = now_seconds();
+        prof_epoch_begin(samples, num_workers);
+
+        current_lr = scheduled_lr(training_epoch);
+        if (freeze_embeddings && !projection_current()) build_projection();
+        float total_loss = run_epoch(samples);
+		double t = now_seconds();
 		update_weights();
-		clear_gradients();
-		report_progress(training_epoch, total_loss, epoch_start);
+		prof_add(0, PROF_UPDATE, t, 0.0);
+		invalidate_projection();  // W[0] (and maybe embed) changed
+		invalidate_mips();
+		checkpoint_id = 0;        // no saved file holds these weights yet
+		if (precision_mode == PRECISION_BF16) sync_bf16_weights();
+		epochs_trained++;
+		prof_epoch_end(training_epoch, samples, epoch_start);
+		report_progress(training_epoch, total_loss, now_seconds() - epoch_start);
 
-		if ((training_epoch + 1) % 10 == 0 && training_epoch > 0) {
-			save_model();
+		// Snapshot now, write in the background while training continues
+		if (epochs_trained % 10 == 0) {
+			checkpoint_async();
 		}
 		
     }
@@ -0,0 +1,266 @@
+// Hierarchical softmax over a Huffman tree of token frequencies.
+// Leaves are token ids 0..V-1 and inner nodes are V..2V-2, with the
+// root at 2V-2. Each inner node n has a vector W_tree[n - V] and
+// P(go to child[1]) = sigmoid(W_tree[n - V] . h). A token's probability
+// is the product of the branch probabilities on its root-to-leaf path,
+// so training and sampling touch O(log V) vectors instead of all V rows.
+#include "brook.h"
+
+int tree_ready = 0;
+int tree_vocab_size = 0;
+int tree_hidden_size = 0;
+int tree_max_depth = 0;
+float* W_tree = NULL;              // (tree_vocab_size - 1) x tree_hidden_size
+int* tree_child = NULL;            // (tree_vocab_size - 1) x 2 node ids
+int* tree_path_offset = NULL;      // tree_vocab_size + 1 offsets into the path arrays
+int* tree_path_node = NULL;        // inner node index (0-based) per step, root first
+unsigned char* tree_path_bit = NULL;  // branch taken per step
+
+void free_tree() {
+    free(W_tree);
+    free(tree_child);
+    free(tree_path_offset);
+    free(tree_path_node);
+    free(tree_path_bit);
+    W_tree = NULL;
+    tree_child = NULL;
+    tree_path_offset = NULL;
+    tree_path_node = NULL;
+    tree_path_bit = NULL;
+    tree_ready = 0;
+    tree_vocab_size = 0;
+    tree_max_depth = 0;
+}
+
+/**
+ * Derives every leaf's root-to-leaf path from tree_child.
+ */
+static void build_tree_paths() {
+    int V = tree_vocab_size;
+    int num_nodes = 2 * V - 1;
+    int* parent = malloc(num_nodes * sizeof(int));
+    unsigned char* bit = malloc(num_nodes);
+    parent[num_nodes - 1] = -1;
+    bit[num_nodes - 1] = 0;
+    for (int n = 0; n < V - 1; n++) {
+        for (int c = 0; c < 2; c++) {
+            parent[tree_child[n * 2 + c]] = V + n;
+            bit[tree_child[n * 2 + c]] = (unsigned char)c;
+        }
+    }
+
+    // Path lengths first, then fill each path from the leaf upward
+    tree_path_offset = malloc((V + 1) * sizeof(int));
+    tree_path_offset[0] = 0;
+    tree_max_depth = 0;
+    for (int v = 0; v < V; v++) {
+        int depth = 0;
+        for (int n = v; parent[n] != -1; n = parent[n]) depth++;
+        tree_path_offset[v + 1] = tree_path_offset[v] + depth;
+        if (depth > tree_max_depth) tree_max_depth = depth;
+    }
+    tree_path_node = malloc(tree_path_offset[V] * sizeof(int));
+    tree_path_bit = malloc(tree_path_offset[V]);
+    for (int v = 0; v < V; v++) {
+        int k = tree_path_offset[v + 1];
+        for (int n = v; parent[n] != -1; n = parent[n]) {
+            k--;
+            tree_path_node[k] = parent[n] - V;
+            tree_path_bit[k] = bit[n];
+        }
+    }
+    free(parent);
+    free(bit);
+}
+
+/**
+ * Builds a Huffman tree over the token frequencies in tokens[] and
+ * zero-initializes the inner-node vectors. Unseen words get a count of
+ * one so they remain reachable.
+ */
+void build_tree(int hidden_size) {
+    free_tree();
+    int V = vocab_size;
+    if (V < 2) return;
+
+    long long* count = calloc(2 * V - 1, sizeof(long long));
+    int* order = malloc(V * sizeof(int));
+    for (int i = 0; i < token_count; i++) {
+        if (tokens[i] >= 0 && tokens[i] < V) count[tokens[i]]++;
+    }
+    for (int v = 0; v < V; v++) {
+        count[v]++;
+        order[v] = v;
+    }
+    // Shell sort leaves by ascending count
+    for (int gap = V / 2; gap > 0; gap /= 2) {
+        for (int i = gap; i < V; i++) {
+            int tmp = order[i];
+            int j = i;
+            while (j >= gap && count[order[j - gap]] > count[tmp]) {
+                order[j] = order[j - gap];
+                j -= gap;
+            }
+            order[j] = tmp;
+        }
+    }
+
+    // Classic two-queue Huffman merge: sorted leaves and inner nodes
+    // (which are created in non-decreasing count order)
+    tree_vocab_size = V;
+    tree_hidden_size = hidden_size;
+    tree_child = malloc((V - 1) * 2 * sizeof(int));
+    int leaf = 0, inner = 0;
+    for (int n = 0; n < V - 1; n++) {
+        int pick[2];
+        for (int c = 0; c < 2; c++) {
+            // Inner nodes [inner, n) are waiting to be merged
+            if (leaf < V && (inner >= n || count[order[leaf]] <= count[V + inner])) {
+                pick[c] = order[leaf++];
+            } else {
+                pick[c] = V + inner++;
+            }
+        }
+        tree_child[n * 2 + 0] = pick[0];
+        tree_child[n * 2 + 1] = pick[1];
+        count[V + n] = count[pick[0]] + count[pick[1]];
+    }
+    free(count);
+    free(order);
+
+    build_tree_paths();
+    W_tree = calloc((size_t)(V - 1) * hidden_size, sizeof(float));
+    tree_ready = 1;
+    printf("Built Huffman tree: %d leaves, max depth %d, avg depth %.1f\n",
+           V, tree_max_depth, (float)tree_path_offset[V] / V);
+}
+
+/**
+ * Samples a token by walking from the root, taking each branch with its
+ * sigmoid probability sharpened or flattened by temperature. rng is
+ * the caller's session PRNG state.
+ */
+int tree_sample(const float* h, float temperature, uint64_t* rng) {
+    if (!tree_ready) return 0;
+    int V = tree_vocab_size;
+    int node = 2 * V - 2;
+    if (temperature <= 0.0f) temperature = 1e-6f;
+    while (node >= V) {
+        const float* v = &W_tree[(size_t)(node - V) * tree_hidden_size];
+        float z = simd->dot(v, h, tree_hidden_size);
+        float p = 1.0f / (1.0f + expf(-z / temperature));
+        float r = rng_float(rng);
+        node = tree_child[(node - V) * 2 + (r < p ? 1 : 0)];
+    }
+    return node;
+}
+
+// log(sigmoid(x)) without overflow for large |x|
+static float log_sigmoid(float x) {
+    return x >= 0.0f ? -log1pf(expf(-x)) : x - log1pf(expf(x));
+}
+
+/**
+ * Turns the inner-node scores z[n] = W_tree[n] . h of one context into
+ * the log-probability of every leaf, logp[tree_vocab_size]. inner is
+ * scratch for the tree_vocab_size - 1 inner-node log-probabilities.
+ * Children are always numbered below their parent, so one pass from the
+ * root down reaches every node after its parent. The result is
+ * normalized: it can stand in for logits wherever they are softmaxed.
+ */
+void tree_log_probs(const float* z, float* inner, float* logp) {
+    int V = tree_vocab_size;
+    inner[V - 2] = 0.0f;
+    for (int n = V - 2; n >= 0; n--) {
+        for (int c = 0; c < 2; c++) {
+            int child = tree_child[n * 2 + c];
+            float lp = inner[n] + log_sigmoid(c ? z[n] : -z[n]);
+            if (child >= V) inner[child - V] = lp;
+            else logp[child] = lp;
+        }
+    }
+}
+
+// Whether predictions come from the tree: tree mode with a tree that
+// matches the vocabulary (otherwise predict falls back to W_output)
+int tree_in_use() {
+    return softmax_mode == SOFTMAX_TREE && tree_ready && tree_vocab_size == vocab_size;
+}
+
+void write_tree(FILE* f) {
+    int magic = TREE_MAGIC, version = 2;
+    fwrite(&magic, sizeof(int), 1, f);
+    fwrite(&version, sizeof(int), 1, f);
+    fwrite(&checkpoint_id, sizeof(uint32_t), 1, f);
+    fwrite(&tree_vocab_size, sizeof(int), 1, f);
+    fwrite(&tree_hidden_size, sizeof(int), 1, f);
+    fwrite(tree_child, sizeof(int), (size_t)(tree_vocab_size - 1) * 2, f);
+    fwrite(W_tree, sizeof(float), (size_t)(tree_vocab_size - 1) * tree_hidden_size, f);
+}
+
+/**
+ * Loads tree.bin if present and it matches the current vocabulary, last
+ * hidden layer and checkpoint id (version 1 files have id 0). Returns 1
+ * on success.
+ */
+int load_tree() {
+    FILE* f = fopen("tree.bin", "rb");
+    if (!f) return 0;
+    int magic, version, V, hidden;
+    uint32_t id = 0;
+    if (fread(&magic, sizeof(int), 1, f) != 1 || magic != TREE_MAGIC ||
+        fread(&version, sizeof(int), 1, f) != 1 || version < 1 || version > 2 ||
+        (version == 2 && fread(&id, sizeof(uint32_t), 1, f) != 1) ||
+        fread(&V, sizeof(int), 1, f) != 1 ||
+        fread(&hidden, sizeof(int), 1, f) != 1) {
+        printf("Error reading tree.bin header\n");
+        fclose(f);
+        return 0;
+    }
+    if (V != vocab_size || V < 2 || hidden != hidden_sizes[num_hidden_layers - 1]) {
+        printf("Ignoring tree.bin: built for %d words x %d hidden, model has %d x %d\n",
+               V, hidden, vocab_size, hidden_sizes[num_hidden_layers - 1]);
+        fclose(f);
+        return 0;
+    }
+    if (id != checkpoint_id) {
+        printf("Ignoring tree.bin: it was saved with a different checkpoint than weights.bin\n");
+        fclose(f);
+        return 0;
+    }
+    free_tree();
+    tree_vocab_size = V;
+    tree_hidden_size = hidden;
+    tree_child = malloc((size_t)(V - 1) * 2 * sizeof(int));
+    W_tree = malloc((size_t)(V - 1) * hidden * sizeof(float));
+    size_t child_count = (size_t)(V - 1) * 2;
+    size_t weight_count = (size_t)(V - 1) * hidden;
+    if (fread(tree_child, sizeof(int), child_count, f) != child_count ||
+        fread(W_tree, sizeof(float), weight_count, f) != weight_count) {
+        printf("Error reading tree.bin\n");
+        fclose(f);
+        free_tree();
+        return 0;
+    }
+    fclose(f);
+
+    // Children must be created before their parent and used exactly once,
+    // which guarantees a single acyclic tree
+    unsigned char* used = calloc(2 * V - 1, 1);
+    int valid = 1;
+    for (size_t i = 0; i < child_count && valid; i++) {
+        int child = tree_child[i];
+        if (child < 0 || child >= V + (int)(i / 2) || used[child]) valid = 0;
+        else used[child] = 1;
+    }
+    free(used);
+    if (!valid) {
+        printf("Error: tree.bin is not a valid tree\n");
+        free_tree();
+        return 0;
+    }
+    build_tree_paths();
+    tree_ready = 1;
+    printf("Loaded tree.bin: %d leaves, max depth %d\n", V, tree_max_depth);
+    return 1;
+}
@@ -5,52 +5,193 @@ void to_lowercase(char* s) {
         s[i] = tolower((unsigned char)s[i]);
 }
 
+// Monotonic wall-clock time in seconds, for timing intervals
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * malloc with SIMD_ALIGN alignment (free with free()). Weights and
+ * activations come from here so every row whose length is a multiple of
+ * the vector width starts aligned and the kernels can use aligned loads.
+ */
+void* alloc_aligned(size_t bytes) {
+    void* p;
+    bytes = (bytes + SIMD_ALIGN - 1) & ~(size_t)(SIMD_ALIGN - 1);
+    if (posix_memalign(&p, SIMD_ALIGN, bytes ? bytes : SIMD_ALIGN) != 0) return NULL;
+    return p;
+}
+
+void* calloc_aligned(size_t count, size_t size) {
+    void* p = alloc_aligned(count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+// realloc that keeps the alignment: copies min(old_bytes, new_bytes)
+void* realloc_aligned(void* p, size_t old_bytes, size_t new_bytes) {
+    void* grown = alloc_aligned(new_bytes);
+    if (!grown) return NULL;
+    if (p) {
+        memcpy(grown, p, old_bytes < new_bytes ? old_bytes : new_bytes);
+        free(p);
+    }
+    return grown;
+}
+
 // Assumes row-major W[out_size][in_size]
-// x and out are aligned float arrays
+// Dispatches to the widest SIMD matvec kernel the CPU supports
 void fast_matmul(const float * restrict W,
                  const float * restrict x,
                  float * restrict out,
                  int out_size,
                  int in_size)
 {
-    // Pick tile size for cache line efficiency
-    const int TILE_SIZE = 64;
+    simd->matvec(W, x, out, out_size, in_size);
+}
 
-    // Initialize output
+// out[in_size] = W^T * x for row-major W[out_size][in_size]
+// Backpropagates deltas through a layer. Rather than walking W column by
+// column (stride in_size), each row is streamed once and axpy'd into out,
+// so memory is read sequentially. Zero deltas (dead ReLUs) are skipped.
+void fast_matmul_t(const float * restrict W,
+                   const float * restrict x,
+                   float * restrict out,
+                   int out_size,
+                   int in_size)
+{
+    memset(out, 0, in_size * sizeof(float));
     for (int i = 0; i < out_size; i++) {
-        out[i] = 0.0f;
-    }
-
-    // Main tiled loop
-    for (int jj = 0; jj < in_size; jj += TILE_SIZE) {
-        int j_end = (jj + TILE_SIZE < in_size) ? (jj + TILE_SIZE) : in_size;
-
-        for (int i = 0; i < out_size; i++) {
-            const float *w_ptr = &W[i * in_size + jj];
-            const float *x_ptr = &x[jj];
-            float sum = 0.0f;
-
-            int j = 0;
-            // Unroll by 8 for better ILP (Instruction Level Parallelism)
-            for (; j + 7 < (j_end - jj); j += 8) {
-                sum += w_ptr[j]     * x_ptr[j] +
-                       w_ptr[j + 1] * x_ptr[j + 1] +
-                       w_ptr[j + 2] * x_ptr[j + 2] +
-                       w_ptr[j + 3] * x_ptr[j + 3] +
-                       w_ptr[j + 4] * x_ptr[j + 4] +
-                       w_ptr[j + 5] * x_ptr[j + 5] +
-                       w_ptr[j + 6] * x_ptr[j + 6] +
-                       w_ptr[j + 7] * x_ptr[j + 7];
-            }
-            // Handle remainder
-            for (; j < (j_end - jj); j++) {
-                sum += w_ptr[j] * x_ptr[j];
+        if (x[i] == 0.0f) continue;
+        simd->axpy(x[i], &W[(size_t)i * in_size], out, in_size);
+    }
+}
+
+// bf16-weight variants of fast_matmul / fast_matmul_t for mixed
+// precision training: half the weight bytes, fp32 accumulation
+void fast_matmul_bf16(const bf16 * restrict W,
+                      const float * restrict x,
+                      float * restrict out,
+                      int out_size,
+                      int in_size)
+{
+    simd->matvec_bf16(W, x, out, out_size, in_size);
+}
+
+void fast_matmul_t_bf16(const bf16 * restrict W,
+                        const float * restrict x,
+                        float * restrict out,
+                        int out_size,
+                        int in_size)
+{
+    memset(out, 0, in_size * sizeof(float));
+    for (int i = 0; i < out_size; i++) {
+        if (x[i] == 0.0f) continue;
+        simd->axpy_bf16(x[i], &W[(size_t)i * in_size], out, in_size);
+    }
+}
+
+// Batched kernels for mini-batch training. All matrices are row-major.
+
+// C[M][N] = A[M][K] * B[N][K]^T
+// Forward layer pass: A is a batch of inputs, B is a weight matrix.
+// B is walked in row tiles so a tile stays in cache while the whole
+// batch streams past it through the register-blocked gemm_nt kernel.
+void fast_gemm_nt(const float * restrict A,
+                  const float * restrict B,
+                  float * restrict C,
+                  int M, int N, int K)
+{
+    const int TILE_N = 64;
+
+    for (int jj = 0; jj < N; jj += TILE_N) {
+        int j_end = (jj + TILE_N < N) ? (jj + TILE_N) : N;
+        simd->gemm_nt(A, &B[(size_t)jj * K], &C[jj], M, j_end - jj, K, N);
+    }
+}
+
+// C[M][N] = A[M][K] * B[K][N]
+// Backpropagates a batch of deltas A through weights B. Each C row is
+// built from contiguous axpys over B rows, skipping zero deltas (dead
+// ReLUs), and B is walked in row tiles shared by the whole batch.
+void fast_gemm_nn(const float * restrict A,
+                  const float * restrict B,
+                  float * restrict C,
+                  int M, int N, int K)
+{
+    const int TILE_K = 64;
+
+    memset(C, 0, (size_t)M * N * sizeof(float));
+    for (int kk = 0; kk < K; kk += TILE_K) {
+        int k_end = (kk + TILE_K < K) ? (kk + TILE_K) : K;
+        for (int i = 0; i < M; i++) {
+            const float *a = &A[i * K];
+            float *c = &C[i * N];
+            for (int k = kk; k < k_end; k++) {
+                float ak = a[k];
+                if (ak == 0.0f) continue;
+                simd->axpy(ak, &B[(size_t)k * N], c, N);
             }
+        }
+    }
+}
 
-            out[i] += sum;
+// fast_gemm_nt / fast_gemm_nn with a bf16 weight matrix B. The nt form
+// is one bf16 matvec per batch row over each B tile, not register-blocked.
+void fast_gemm_nt_bf16(const float * restrict A,
+                       const bf16 * restrict B,
+                       float * restrict C,
+                       int M, int N, int K)
+{
+    const int TILE_N = 64;
+
+    for (int jj = 0; jj < N; jj += TILE_N) {
+        int j_end = (jj + TILE_N < N) ? (jj + TILE_N) : N;
+        for (int i = 0; i < M; i++) {
+            simd->matvec_bf16(&B[(size_t)jj * K], &A[(size_t)i * K], &C[(size_t)i * N + jj], j_end - jj, K);
         }
     }
 }
 
+void fast_gemm_nn_bf16(const float * restrict A,
+                       const bf16 * restrict B,
+                       float * restrict C,
+                       int M, int N, int K)
+{
+    const int TILE_K = 64;
 
+    memset(C, 0, (size_t)M * N * sizeof(float));
+    for (int kk = 0; kk < K; kk += TILE_K) {
+        int k_end = (kk + TILE_K < K) ? (kk + TILE_K) : K;
+        for (int i = 0; i < M; i++) {
+            const float *a = &A[i * K];
+            float *c = &C[i * N];
+            for (int k = kk; k < k_end; k++) {
+                float ak = a[k];
+                if (ak == 0.0f) continue;
+                simd->axpy_bf16(ak, &B[(size_t)k * N], c, N);
+            }
+        }
+    }
+}
 
+// C[M][N] += A[K][M]^T * B[K][N]
+// Accumulates weight gradients: A is a batch of deltas, B the batch of
+// layer inputs. Each C row is loaded once per batch rather than once
+// per sample, and B (batch x inputs) stays resident in cache.
+void fast_gemm_tn_acc(const float * restrict A,
+                      const float * restrict B,
+                      float * restrict C,
+                      int M, int N, int K)
+{
+    for (int i = 0; i < M; i++) {
+        float *c = &C[i * N];
+        for (int k = 0; k < K; k++) {
+            float a = A[k * M + i];
+            if (a == 0.0f) continue;
+            simd->axpy(a, &B[(size_t)k * N], c, N);
+        }
+    }
+}